@@ -31,25 +31,6 @@
 #include <sdControl.h>
 
 WiFiServer controlServer(FTP_CTRL_PORT);
-WiFiServer dataServer(FTP_DATA_PORT_PASV);
-
-static String EpochToISO(time_t epochTime)
-{
-  tm localTime;                        // the structure tm holds time information in a more convenient way
-  localtime_r(&epochTime, &localTime); // update the structure tm with the current time
-
-  // Format into YYYYMMDDHHMMSS
-  char buffer[35];
-  snprintf(buffer, sizeof(buffer), "%04d%02d%02d%02d%02d%02d",
-           (1900 + localTime.tm_year),
-           localTime.tm_mon,
-           (1 + localTime.tm_mday),
-           localTime.tm_hour,
-           localTime.tm_min,
-           localTime.tm_min);
-
-  return String(buffer);
-}
 
 void FtpServer::addUser(String uname, String pword, int16_t pin)
 {
@@ -71,69 +52,247 @@ void FtpServer::begin()
   controlServer.begin();
   delay(10);
 
-  dataServer.begin();
+  for (uint8_t i = 0u; i < FTP_PASV_PORTS; i++)
+  {
+    _pasvPort[i].port = FTP_DATA_PORT_PASV + i;
+    _pasvPort[i].owner = nullptr;
+    _pasvPort[i].server.begin(_pasvPort[i].port);
+  }
   delay(10);
 
+  for (uint8_t i = 0u; i < FTP_MAX_SESSIONS; i++)
+  {
+    _session[i].begin(this);
+  }
+
+  configTime(MY_TZ, MY_NTP_SERVER);
+}
+
+void FtpServer::handleFTP()
+{
+  uint32_t start = micros();
+
+  if (controlServer.hasClient())
+  {
+    WiFiClient newClient = controlServer.accept();
+    FtpSession *freeSession = nullptr;
+    for (uint8_t i = 0u; i < FTP_MAX_SESSIONS; i++)
+    {
+      if (_session[i].isFree())
+      {
+        freeSession = &_session[i];
+        break;
+      }
+    }
+    if (freeSession != nullptr)
+    {
+      freeSession->attach(newClient);
+    }
+    else
+    {
+#ifdef FTP_DEBUG
+      Serial.println("No free session, rejecting client");
+#endif
+      newClient.println("421 Too many connections, try again later");
+      newClient.stop();
+    }
+  }
+
+  // Sessions are run again while transfers move data, until the time or
+  //   byte budget of the call is used, so the sketch gets back control
+  //   within a bounded time without slowing down transfers
+  uint32_t bytes = 0;
+  uint32_t moved;
+  do
+  {
+    moved = 0;
+    for (uint8_t i = 0u; i < FTP_MAX_SESSIONS; i++)
+    {
+      moved += _session[i].handle();
+    }
+    bytes += moved;
+  } while (moved > 0 && bytes < _budgetBytes && micros() - start < _budgetMicros);
+  _stats.handleTime.add(micros() - start);
+}
+
+// Mount the file system of a user, shared between sessions of the same file system
+//
+// return:
+//    pointer to file system, or nullptr if SD bus is not available
+FS *FtpServer::mountFileSystem(int8_t user)
+{
+  return mountFileSystem(NOT_A_PIN != _user[user].pin ? (FS *)&SDFS : (FS *)&LittleFS);
+}
+
+// Mount SDFS or LittleFS, each mount must be matched by unmountFileSystem()
+FS *FtpServer::mountFileSystem(FS *fs)
+{
+  if (fs == &SDFS)
+  {
+    if (_sdfsSessions == 0u)
+    {
+      if (!sdControl.takeBusControl())
+      {
+        return nullptr;
+      }
+      // Init SD card
+      SDFS.begin();
+    }
+    _sdfsSessions++;
+    return &SDFS;
+  }
+
+  if (_littlefsSessions == 0u)
+  {
+    LittleFS.begin();
+  }
+  _littlefsSessions++;
+  return &LittleFS;
+}
+
+void FtpServer::unmountFileSystem(FS *fs)
+{
+  if (fs == &SDFS && _sdfsSessions > 0u)
+  {
+    if (--_sdfsSessions == 0u)
+    {
+      // Release SD card, the other master may change it from now on, so
+      //   its cached directories go. While the bus is held, the other
+      //   master stays off it and only commands change directories
+      _dirCache.clear();
+      SDFS.end();
+      sdControl.releaseBusControl();
+    }
+  }
+  else if (fs == &LittleFS && _littlefsSessions > 0u)
+  {
+    if (--_littlefsSessions == 0u)
+    {
+      _dirCache.clear();
+      LittleFS.end();
+    }
+  }
+}
+
+void FtpSession::begin(FtpServer *server)
+{
+  _server = server;
+
   millisTimeOut = (uint32_t)FTP_TIME_OUT * 60 * 1000;
   millisDelay = 0;
-  cmdStatus = 0;
+  cmdStatus = DISCONNECTED;
   iniVariables();
+}
 
-  configTime(MY_TZ, MY_NTP_SERVER);
+boolean FtpSession::isFree()
+{
+  return !client.connected();
+}
+
+void FtpSession::attach(WiFiClient &newClient)
+{
+  if (cmdStatus != IDLE)
+  {
+    // Previous client is gone, finish its cleanup now
+    abortTransfer();
+    abortJob();
+    releaseFileSystem();
+    iniVariables();
+    millisDelay = 0;
+    cmdStatus = IDLE;
+  }
+  client.stop();
+  client = newClient;
+  replyLen = 0;
+#if FTP_CTRL_NODELAY
+  client.setNoDelay(true);
+#endif
 }
 
-void FtpServer::iniVariables()
+void FtpSession::iniVariables()
 {
-  // Default for data port
-  dataPort = FTP_DATA_PORT_PASV;
+  // No data port until PASV or EPSV
+  releasePasvPort();
+  dataPort = 0;
 
   // Default Data connection is Active
   dataPassiveConn = true;
+  epsvAll = false;
 
   // Set the root directory
   strcpy(cwdName, "/");
 
   rnfrCmd = false;
-  transferStatus = 0;
+  cpfrCmd = false;
+  modeZ = false;
+  restartOffset = 0;
+  rangeEnd = FTP_NO_RANGE;
+  allocSize = 0;
+  transferStatus = NO_TRANSFER;
+  dataWait = false;
+  jobStatus = NO_JOB;
+  hashAlgo = HASH_SHA256;
 }
 
-void FtpServer::handleFTP()
+void FtpSession::releaseFileSystem()
 {
-  typedef enum
+  if (VirtualFS != nullptr)
   {
-    DISCONNECTED = 0,
-    WAIT_FOR_CONNECTION = 1,
-    IDLE = 2,
-    WAIT_FOR_USER_IDENTITY = 3,
-    WAIT_FOR_USER_PASSWORD = 4,
-    WAIT_FOR_USER_COMMAND = 5,
-    COMMAND_STATUS_COUNT
-  } CommandStatus_t;
+    _server->unmountFileSystem(VirtualFS);
+    VirtualFS = nullptr;
+  }
+}
 
-  const String commandStatusString[COMMAND_STATUS_COUNT] = {
-      "DISCONNECTED",
-      "WAIT_FOR_CONNECTION",
-      "WAIT_FOR_USER_IDENTITY",
-      "WAIT_FOR_USER_PASSWORD",
-      "WAIT_FOR_USER_COMMAND ",
-  };
+// Borrow next free passive port of server
+//
+//  ports are lent in turn, so the one just used, with its last
+//  connection maybe still in TIME_WAIT, is not taken again at once
+//
+// return:
+//    false if all ports are lent to other sessions
 
-  typedef enum
+boolean FtpSession::takePasvPort()
+{
+  releasePasvPort();
+  for (uint8_t i = 0u; i < FTP_PASV_PORTS; i++)
   {
-    NO_TRANSFER = 0,
-    RETRIVE_DATA = 1,
-    STORE_DATA = 2
-  } TransferStatus_t;
+    PasvPort_t *port = &_server->_pasvPort[_server->_nextPasv];
+    _server->_nextPasv = (_server->_nextPasv + 1) % FTP_PASV_PORTS;
+    if (port->owner == nullptr)
+    {
+      // Drop connections nobody was waiting for
+      while (port->server.hasClient())
+      {
+        port->server.accept().stop();
+      }
+      port->owner = this;
+      pasv = port;
+      dataPort = port->port;
+      return true;
+    }
+  }
+  return false;
+}
 
-  if ((int32_t)(millisDelay - millis()) > 0)
+void FtpSession::releasePasvPort()
+{
+  if (pasv != nullptr)
   {
-    return;
+    pasv->owner = nullptr;
+    pasv = nullptr;
   }
+}
 
-  if (controlServer.hasClient())
+// Run session: process received commands and move next part of transfer
+//
+// return:
+//    bytes moved on data connection
+
+uint32_t FtpSession::handle()
+{
+  if ((int32_t)(millisDelay - millis()) > 0)
   {
-    client.stop();
-    client = controlServer.accept();
+    return 0;
   }
 
   if (cmdStatus == DISCONNECTED)
@@ -147,6 +306,8 @@ void FtpServer::handleFTP()
   else if (cmdStatus == WAIT_FOR_CONNECTION) // Ftp server waiting for connection
   {
     abortTransfer();
+    abortJob();
+    releaseFileSystem();
     iniVariables();
 #ifdef FTP_DEBUG
     Serial.println("Ftp server waiting for connection on port " + String(FTP_CTRL_PORT));
@@ -162,71 +323,54 @@ void FtpServer::handleFTP()
       cmdStatus = WAIT_FOR_USER_IDENTITY;
     }
   }
-  else if (readChar() > 0) // got response
+  else if (cmdStatus == WAIT_FOR_FILE_SYSTEM) // Logged in, waiting for SD bus
   {
-    if (cmdStatus == WAIT_FOR_USER_IDENTITY)
-    { // Ftp server waiting for user identity
-      if (userIdentity())
-      {
-        cmdStatus = WAIT_FOR_USER_PASSWORD;
-      }
-      else
-      {
-        cmdStatus = DISCONNECTED;
-      }
+    if (!client.connected())
+    {
+      cmdStatus = WAIT_FOR_CONNECTION;
     }
-    else if (cmdStatus == WAIT_FOR_USER_PASSWORD)
+    else
     {
-      // Ftp server waiting for user registration
-      if (userPassword())
-      {
-        if (NOT_A_PIN != _user[_selectedUser].pin)
-        {
-          if (sdControl.takeBusControl())
-          {
-            // Init SD card
-            VirtualFS = &SDFS;
-            VirtualFS->begin();
-          }
-        }
-        else
-        {
-          // Init SD card
-          VirtualFS = &LittleFS;
-          VirtualFS->begin();
-        }
-        cmdStatus = WAIT_FOR_USER_COMMAND;
-        millisEndConnection = millis() + millisTimeOut;
-      }
-      else
-      {
-        cmdStatus = DISCONNECTED;
-      }
+      waitFileSystem();
     }
-    else if (cmdStatus == WAIT_FOR_USER_COMMAND)
-    { // Ftp server waiting for user command
+  }
+  else if (commandReady() && readCommand() > 0) // got response
+  {
+    // Commands pipelined by the client are processed in the same call,
+    //   until one of them starts a transfer
+    do
+    {
+      uint32_t start = micros();
       if (!processCommand())
       {
         cmdStatus = DISCONNECTED;
       }
-      else
+      else if (cmdStatus == WAIT_FOR_USER_COMMAND)
       {
         millisEndConnection = millis() + millisTimeOut;
       }
-    }
+      _server->_stats.commands++;
+      _server->_stats.commandTime.add(micros() - start);
+    } while (cmdStatus > IDLE && cmdStatus != WAIT_FOR_FILE_SYSTEM && commandReady() && readCommand() > 0);
   }
   else if (!client.connected() || !client)
   {
+    // File system is released while waiting for next connection
     cmdStatus = WAIT_FOR_CONNECTION;
 #ifdef FTP_DEBUG
     Serial.println("client disconnected");
 #endif
-    // Release SD card
-    VirtualFS->end();
-    sdControl.releaseBusControl();
   }
 
-  if (transferStatus == RETRIVE_DATA) // Retrieve data
+  uint32_t before = bytesTransfered;
+  uint32_t jobBytes = 0;
+  if (dataWait) // Wait for data connection
+  {
+    if (!waitDataConnection())
+      transferStatus = NO_TRANSFER;
+    before = bytesTransfered; // counter starts over with the transfer
+  }
+  else if (transferStatus == RETRIVE_DATA) // Retrieve data
   {
     if (!doRetrieve())
       transferStatus = NO_TRANSFER;
@@ -236,111 +380,156 @@ void FtpServer::handleFTP()
     if (!doStore())
       transferStatus = NO_TRANSFER;
   }
+  else if (transferStatus == LIST_DATA) // Send directory listing
+  {
+    if (!doList())
+      transferStatus = NO_TRANSFER;
+  }
+  else if (jobStatus != NO_JOB) // Work of HASH, SITE CPTO or SITE RMDIR -r in background
+  {
+    jobBytes = doJob();
+  }
   else if (cmdStatus > IDLE && !((int32_t)(millisEndConnection - millis()) > 0))
   {
-    client.println("530 Timeout");
+    reply(530, "Timeout");
     millisDelay = millis() + 200; // delay of 200 ms
     cmdStatus = DISCONNECTED;
   }
+  flushReplies();
+  return bytesTransfered - before + jobBytes;
 }
 
-void FtpServer::clientConnected()
+void FtpSession::clientConnected()
 {
 #ifdef FTP_DEBUG
   Serial.println("Client connected!");
 #endif
-  client.println("220--- Welcome to FTP for ESP8266/ESP32 ---");
-  client.println("220---   By David Paiva   ---");
-  client.println("220 --   Version " + String(FTP_SERVER_VERSION) + "   --");
+  replyPart(220, "-- Welcome to FTP for ESP8266/ESP32 ---");
+  replyPart(220, "--   By David Paiva   ---");
+  reply(220, "--   Version %s   --", FTP_SERVER_VERSION);
   iCL = 0;
+  iCB = 0;
+  cmdSkip = false;
+}
+
+// Mount file system of user logging in, then end the reply to PASS
+//
+//  while the SD bus is held by the other master, the reply waits until
+//  the bus is free, 230, or FTP_FS_TIME_OUT, 421. No line is sent before,
+//  as no reply opened with 230 may end with 421
+
+void FtpSession::waitFileSystem()
+{
+  VirtualFS = _server->mountFileSystem(_selectedUser);
+  if (VirtualFS != nullptr)
+  {
+    reply(230, "OK.");
+    cmdStatus = WAIT_FOR_USER_COMMAND;
+    millisEndConnection = millis() + millisTimeOut;
+  }
+  else if (!((int32_t)(millisEndConnection - millis()) > 0))
+  {
+    reply(421, "SD card is busy, try again later");
+    cmdStatus = DISCONNECTED;
+  }
 }
 
-void FtpServer::disconnectClient()
+void FtpSession::disconnectClient()
 {
 #ifdef FTP_DEBUG
   Serial.println(" Disconnecting client");
 #endif
   abortTransfer();
-  client.println("221 Goodbye");
+  abortJob();
+  reply(221, "Goodbye");
+  flushReplies();
   client.stop();
 }
 
-boolean FtpServer::userIdentity()
-{
-  if (strcmp(command, "USER"))
-  {
-    client.println("500 Syntax error");
-  }
+///////////////////////////////////////
+//                                   //
+//      ACCESS CONTROL COMMANDS      //
+//                                   //
+///////////////////////////////////////
 
+//
+//  USER - User Name
+//
+bool FtpSession::command_USER()
+{
   _selectedUser = -1;
-  for (uint8_t i = 0u; i < _userIndex; i++)
+  for (uint8_t i = 0u; i < _server->_userIndex; i++)
   {
-    if (0 == strcmp(parameters, _user[i].name.c_str()))
+    if (0 == strcmp(parameters, _server->_user[i].name.c_str()))
     {
       _selectedUser = i;
-      client.println("331 OK. Password required");
+      reply(331, "OK. Password required");
       strcpy(cwdName, "/");
+      cmdStatus = WAIT_FOR_USER_PASSWORD;
       return true;
     }
   }
 
-  client.println("530 user not found");
+  reply(530, "user not found");
 
   millisDelay = millis() + 100; // delay of 100 ms
   return false;
 }
-
-boolean FtpServer::userPassword()
+//
+//  PASS - Password
+//
+bool FtpSession::command_PASS()
 {
-  if (strcmp(command, "PASS"))
-  {
-    client.println("500 Syntax error");
-  }
-  else if (strcmp(parameters, _user[_selectedUser].password.c_str()))
+  if (strcmp(parameters, _server->_user[_selectedUser].password.c_str()))
   {
-    client.println("530 ");
+    reply(530, "Login incorrect");
+    millisDelay = millis() + 100; // delay of 100 ms
+    return false;
   }
-  else
-  {
 #ifdef FTP_DEBUG
-    Serial.println("OK. Waiting for commands.");
+  Serial.println("OK. Waiting for commands.");
 #endif
-    client.println("230 OK.");
-    return true;
-  }
-  millisDelay = millis() + 100; // delay of 100 ms
-  return false;
+  // SD bus may be used by the other master, login completes when it is free
+  cmdStatus = WAIT_FOR_FILE_SYSTEM;
+  millisEndConnection = millis() + (uint32_t)FTP_FS_TIME_OUT * 1000;
+  waitFileSystem();
+  return true;
 }
-
-///////////////////////////////////////
-//                                   //
-//      ACCESS CONTROL COMMANDS      //
-//                                   //
-///////////////////////////////////////
-
 //
 //  CDUP - Change to Parent Directory
 //
-bool FtpServer::command_CDUP()
+bool FtpSession::command_CDUP()
 {
-  client.println("250 Ok. Current directory is " + String(cwdName));
+  char *slash = strrchr(cwdName, '/');
+  if (slash == cwdName)
+    strcpy(cwdName, "/");
+  else if (slash != NULL)
+    *slash = 0;
+  reply(250, "Ok. Current directory is %s", cwdName);
   return true;
 }
 
 //
 //  CWD - Change Working Directory
 //
-bool FtpServer::command_CWD()
+bool FtpSession::command_CWD()
 {
   char path[FTP_CWD_SIZE];
   if (strcmp(parameters, ".") == 0)
   { // 'CWD .' is the same as PWD command
-    client.println("257 \"" + String(cwdName) + "\" is your current directory");
+    reply(257, "\"%s\" is your current directory", cwdName);
   }
-  else
+  else if (makePath(path))
   {
-    strcpy(cwdName, parameters);
-    client.println("250 Ok. Current directory is " + String(cwdName));
+    if (!isDirectory(path))
+    {
+      reply(550, "Can't change directory to %s", parameters);
+    }
+    else
+    {
+      strcpy(cwdName, path);
+      reply(250, "Ok. Current directory is %s", cwdName);
+    }
   }
   return true;
 }
@@ -348,15 +537,15 @@ bool FtpServer::command_CWD()
 //
 //  PWD - Print Directory
 //
-bool FtpServer::command_PWD()
+bool FtpSession::command_PWD()
 {
-  client.println("257 \"" + String(cwdName) + "\" is your current directory");
+  reply(257, "\"%s\" is your current directory", cwdName);
   return true;
 }
 //
 //  QUIT
 //
-bool FtpServer::command_QUIT()
+bool FtpSession::command_QUIT()
 {
   disconnectClient();
   return false;
@@ -371,72 +560,132 @@ bool FtpServer::command_QUIT()
 //
 //  MODE - Transfer Mode
 //
-bool FtpServer::command_MODE()
+bool FtpSession::command_MODE()
 {
   if (!strcmp(parameters, "S"))
   {
-    client.println("200 S Ok");
+    modeZ = false;
+    reply(200, "S Ok");
+  }
+  else if (!strcmp(parameters, "Z"))
+  {
+    modeZ = true;
+    reply(200, "Z Ok");
   }
   // else if( ! strcmp( parameters, "B" ))
   //  client.println( "200 B Ok\r\n";
   else
   {
-    client.println("504 Only S(tream) is suported");
+    reply(504, "Only S(tream) and Z(lib) are suported");
   }
   return true;
 }
 //
 //  PASV - Passive Connection management
 //
-bool FtpServer::command_PASV()
+bool FtpSession::command_PASV()
 {
   if (data.connected())
   {
     data.stop();
   }
-  // dataServer.begin();
+  if (epsvAll)
+  {
+    reply(503, "EPSV ALL in effect");
+    return true;
+  }
+  if (!takePasvPort())
+  {
+    reply(425, "No passive port available");
+    return true;
+  }
   // dataIp = Ethernet.localIP();
   dataIp = client.localIP();
-  dataPort = FTP_DATA_PORT_PASV;
-// data.connect( dataIp, dataPort );
-// data = dataServer.available();
 #ifdef FTP_DEBUG
   Serial.println("Connection management set to passive");
   Serial.println("Data port set to " + String(dataPort));
 #endif
-  client.println("227 Entering Passive Mode (" + String(dataIp[0]) + "," + String(dataIp[1]) + "," + String(dataIp[2]) + "," + String(dataIp[3]) + "," + String(dataPort >> 8) + "," + String(dataPort & 255) + ").");
+  reply(227, "Entering Passive Mode (%u,%u,%u,%u,%u,%u).", dataIp[0], dataIp[1], dataIp[2], dataIp[3],
+        dataPort >> 8, dataPort & 255);
+  dataPassiveConn = true;
+  return true;
+}
+//
+//  EPSV - Extended Passive Connection (see RFC 2428)
+//
+bool FtpSession::command_EPSV()
+{
+  if (data.connected())
+  {
+    data.stop();
+  }
+  if (!strcasecmp(parameters, "ALL"))
+  {
+    epsvAll = true;
+    reply(200, "EPSV ALL Ok");
+    return true;
+  }
+  if (strlen(parameters) > 0 && strcmp(parameters, "1"))
+  {
+    reply(522, "Network protocol not supported, use (1)");
+    return true;
+  }
+  if (!takePasvPort())
+  {
+    reply(425, "No passive port available");
+    return true;
+  }
+#ifdef FTP_DEBUG
+  Serial.println("Connection management set to extended passive");
+  Serial.println("Data port set to " + String(dataPort));
+#endif
+  reply(229, "Entering Extended Passive Mode (|||%u|)", dataPort);
   dataPassiveConn = true;
   return true;
 }
 //
 //  PORT - Data Port
 //
-bool FtpServer::command_PORT()
+bool FtpSession::command_PORT()
 {
   if (data)
   {
     data.stop();
   }
-  // get IP of data client
-  dataIp[0] = atoi(parameters);
-  char *p = strchr(parameters, ',');
-  for (uint8_t i = 1; i < 4; i++)
+  if (epsvAll)
+  {
+    reply(503, "EPSV ALL in effect");
+    return true;
+  }
+  // Active connections are not supported, next transfer fails with 425
+  releasePasvPort();
+  // get IP and port of data client: h1,h2,h3,h4,p1,p2
+  uint16_t field[6];
+  char *p = parameters;
+  uint8_t n = 0;
+  while (n < 6 && isdigit(*p))
   {
-    dataIp[i] = atoi(++p);
-    p = strchr(p, ',');
+    char *end;
+    unsigned long v = strtoul(p, &end, 10);
+    if (v > 255 || (*end != ',' && n < 5))
+    {
+      break;
+    }
+    field[n++] = v;
+    p = end + (n < 6);
   }
-  // get port of data client
-  dataPort = 256 * atoi(++p);
-  p = strchr(p, ',');
-  dataPort += atoi(++p);
-  if (p == NULL)
+  if (n < 6 || *p != 0)
   {
-    client.println("501 Can't interpret parameters");
+    reply(501, "Can't interpret parameters");
   }
   else
   {
-
-    client.println("200 PORT command successful");
+    for (uint8_t i = 0; i < 4; i++)
+    {
+      dataIp[i] = field[i];
+    }
+    dataPort = 256 * field[4] + field[5];
+    reply(200, "PORT command successful");
     dataPassiveConn = false;
   }
   return true;
@@ -444,36 +693,36 @@ bool FtpServer::command_PORT()
 //
 //  STRU - File Structure
 //
-bool FtpServer::command_STRU()
+bool FtpSession::command_STRU()
 {
   if (!strcmp(parameters, "F"))
   {
-    client.println("200 F Ok");
+    reply(200, "F Ok");
   }
   // else if( ! strcmp( parameters, "R" ))
   //  client.println( "200 B Ok\r\n";
   else
   {
-    client.println("504 Only F(ile) is suported");
+    reply(504, "Only F(ile) is suported");
   }
   return true;
 }
 //
 //  TYPE - Data Type
 //
-bool FtpServer::command_TYPE()
+bool FtpSession::command_TYPE()
 {
   if (!strcmp(parameters, "A"))
   {
-    client.println("200 TYPE is now ASII");
+    reply(200, "TYPE is now ASII");
   }
   else if (!strcmp(parameters, "I"))
   {
-    client.println("200 TYPE is now 8-bit binary");
+    reply(200, "TYPE is now 8-bit binary");
   }
   else
   {
-    client.println("504 Unknow TYPE");
+    reply(504, "Unknow TYPE");
   }
   return true;
 }
@@ -487,34 +736,68 @@ bool FtpServer::command_TYPE()
 //
 //  ABOR - Abort
 //
-bool FtpServer::command_ABOR()
+bool FtpSession::command_ABOR()
 {
   abortTransfer();
-  client.println("226 Data connection closed");
+  abortJob();
+  reply(226, "Data connection closed");
+  return true;
+}
+//
+//  ALLO - Allocate storage for next STOR
+//
+//  file systems can't preallocate, free space is only checked now and
+//  again when STOR comes
+//
+bool FtpSession::command_ALLO()
+{
+  char *end;
+  uint32_t size = strtoul(parameters, &end, 10);
+  uint64_t total, used;
+  if (strlen(parameters) == 0 || (*end != 0 && *end != ' '))
+  {
+    reply(501, "Can't interpret parameters");
+  }
+  else if (!spaceInfo(&total, &used))
+  {
+    reply(202, "Free space unknown, ALLO ignored");
+  }
+  else if (size > total - used)
+  {
+    reply(552, "Not enough space, %llu bytes available", (unsigned long long)(total - used));
+  }
+  else
+  {
+    allocSize = size;
+    reply(200, "%lu bytes allocated", (unsigned long)size);
+  }
   return true;
 }
 //
 //  DELE - Delete a File
 //
-bool FtpServer::command_DELE()
+bool FtpSession::command_DELE()
 {
   char path[FTP_CWD_SIZE];
   if (strlen(parameters) == 0)
   {
-    client.println("501 No file name");
+    reply(501, "No file name");
   }
   else if (makePath(path))
   {
     if (!VirtualFS->exists(path))
     {
-      client.println("550 File " + String(parameters) + " not found");
+      reply(550, "File %s not found", parameters);
     }
     else
     {
       if (VirtualFS->remove(path))
-        client.println("250 Deleted " + String(parameters));
+      {
+        _server->_dirCache.invalidate(VirtualFS, path);
+        reply(250, "Deleted %s", parameters);
+      }
       else
-        client.println("450 Can't delete " + String(parameters));
+        reply(450, "Can't delete %s", parameters);
     }
   }
   return true;
@@ -522,262 +805,185 @@ bool FtpServer::command_DELE()
 //
 //  LIST - List
 //
-bool FtpServer::command_LIST()
+bool FtpSession::command_LIST()
 {
-  if (!dataConnect())
+  if (!dirList.begin(VirtualFS, cwdName, LIST_FORMAT, &_server->_dirCache))
   {
-    client.println("425 No data connection");
+    reply(550, "Can't open directory %s", cwdName);
   }
   else
   {
-    client.println("150 Accepted data connection");
-    uint16_t nm = 0;
-#ifdef ESP8266
-    Dir dir = VirtualFS->openDir(cwdName);
-    if (!VirtualFS->exists(cwdName))
-    {
-      client.println("550 Can't open directory " + String(cwdName));
-    }
-    else
-    {
-      while (dir.next())
-      {
-        String fn, fs;
-
-        fn = dir.fileName();
-        // fn.remove(0, 1);
-        fs = String(dir.fileSize());
-        data.println("+r,s" + fs);
-        data.println(",\t" + fn);
-        nm++;
-      }
-      client.println("226 " + String(nm) + " matches total");
-    }
-#elif defined ESP32
-    File root = VirtualFS->open(cwdName);
-    if (!root)
-    {
-      client.println("550 Can't open directory " + String(cwdName));
-      // return;
-    }
-    else
-    {
-      // if(!root.isDirectory()){
-      // 		Serial.println("Not a directory");
-      // 		return;
-      // }
-
-      File file = root.openNextFile();
-      while (file)
-      {
-        if (file.isDirectory())
-        {
-          data.println("+r,s <DIR> " + String(file.name()));
-          // Serial.print("  DIR : ");
-          // Serial.println(file.name());
-          // if(levels){
-          // 	listDir(fs, file.name(), levels -1);
-          // }
-        }
-        else
-        {
-          String fn, fs;
-          fn = file.name();
-          // fn.remove(0, 1);
-          fs = String(file.size());
-          data.println("+r,s" + fs);
-          data.println(",\t" + fn);
-          nm++;
-        }
-        file = root.openNextFile();
-      }
-      client.println("226 " + String(nm) + " matches total");
-    }
-#endif
-    data.stop();
+    openDataConnection(LIST_DATA);
   }
   return true;
 }
 //
 //  MLSD - Listing for Machine Processing (see RFC 3659)
 //
-bool FtpServer::command_MLSD()
+bool FtpSession::command_MLSD()
 {
-  if (!dataConnect())
+  if (!dirList.begin(VirtualFS, cwdName, MLSD_FORMAT, &_server->_dirCache))
   {
-    client.println("425 No data connection MLSD");
+    reply(550, "Can't open directory %s", cwdName);
   }
   else
   {
-    client.println("150 Accepted data connection");
-    uint16_t nm = 0;
-#ifdef ESP8266
-    Dir dir = VirtualFS->openDir(cwdName);
-    Serial.println(cwdName);
-    char dtStr[15];
-    if (!VirtualFS->exists(cwdName))
-    {
-      client.println("550 Can't open directory " + String(parameters));
-    }
-    else
-    {
-      while (dir.next())
-      {
-        String fn = dir.fileName();
-        String type = dir.isDirectory() ? "dir" : "file";
-        String fs = type == "dir" ? "0" : String(dir.fileSize());
-
-        String modify = type == "dir" ? EpochToISO(dir.fileCreationTime()) : EpochToISO(dir.fileTime());
-        data.println("Type=" + type + ";Size=" + fs + ";modify=" + modify + "; " + fn);
-        nm++;
-      }
-      client.println("226-options: -a -l");
-      client.println("226 " + String(nm) + " matches total");
-    }
-#elif defined ESP32
-    File root = VirtualFS->open(cwdName);
-    // if(!root){
-    // 		client.println( "550 Can't open directory " + String(cwdName) );
-    // 		// return;
-    // } else {
-    // if(!root.isDirectory()){
-    // 		Serial.println("Not a directory");
-    // 		return;
-    // }
-
-    File file = root.openNextFile();
-    while (file)
-    {
-      // if(file.isDirectory()){
-      // 	data.println( "+r,s <DIR> " + String(file.name()));
-      // 	// Serial.print("  DIR : ");
-      // 	// Serial.println(file.name());
-      // 	// if(levels){
-      // 	// 	listDir(fs, file.name(), levels -1);
-      // 	// }
-      // } else {
-      String fn, fs;
-      fn = file.name();
-      fn.remove(0, 1);
-      fs = String(file.size());
-      data.println("Type=file;Size=" + fs + ";" + "modify=20000101160656;" + " " + fn);
-      nm++;
-      // }
-      file = root.openNextFile();
-    }
-    client.println("226-options: -a -l");
-    client.println("226 " + String(nm) + " matches total");
-    // }
-#endif
-    data.stop();
+    openDataConnection(LIST_DATA);
   }
   return true;
 }
 //
 //  NLST - Name List
 //
-bool FtpServer::command_NLST()
+bool FtpSession::command_NLST()
 {
-  if (!dataConnect())
+  if (!dirList.begin(VirtualFS, cwdName, NLST_FORMAT, &_server->_dirCache))
   {
-    client.println("425 No data connection");
+    reply(550, "Can't open directory %s", cwdName);
   }
   else
   {
-    client.println("150 Accepted data connection");
-    uint16_t nm = 0;
-#ifdef ESP8266
-    Dir dir = VirtualFS->openDir(cwdName);
-    if (!VirtualFS->exists(cwdName))
-      client.println("550 Can't open directory " + String(parameters));
-    else
-    {
-      while (dir.next())
-      {
-        data.println(dir.fileName());
-        nm++;
-      }
-      client.println("226 " + String(nm) + " matches total");
-    }
-#elif defined ESP32
-    File root = VirtualFS->open(cwdName);
-    if (!root)
-    {
-      client.println("550 Can't open directory " + String(cwdName));
-    }
-    else
-    {
-
-      File file = root.openNextFile();
-      while (file)
-      {
-        data.println(file.name());
-        nm++;
-        file = root.openNextFile();
-      }
-      client.println("226 " + String(nm) + " matches total");
-    }
-#endif
-    data.stop();
+    openDataConnection(LIST_DATA);
   }
   return true;
 }
 //
 //  NOOP
 //
-bool FtpServer::command_NOOP()
+bool FtpSession::command_NOOP()
 {
   // dataPort = 0;
-  client.println("200 Zzz...");
+  reply(200, "Zzz...");
+  return true;
+}
+//
+//  STAT - Status
+//
+//  tells how far the transfer or the job of the session is. It is
+//  accepted while they run, ahead of queued commands (see commandReady())
+//
+bool FtpSession::command_STAT()
+{
+  if (strlen(parameters) > 0)
+  {
+    reply(504, "STAT of a path is not supported, use MLST");
+    return true;
+  }
+  replyPart(211, "Status of %s", _server->_user[_selectedUser].name.c_str());
+  replyPart(211, "Current directory is %s", cwdName);
+  if (dataWait)
+  {
+    replyPart(211, "Waiting for data connection");
+  }
+  else if (transferStatus != NO_TRANSFER)
+  {
+    replyPart(211, "%s %lu bytes in %lu ms", transferStatus == STORE_DATA ? "Received" : "Sent",
+              (unsigned long)bytesTransfered, (unsigned long)(millis() - millisBeginTrans));
+  }
+  else if (jobStatus == HASH_JOB)
+  {
+    replyPart(211, "Digesting %s, %lu bytes left", jobName, (unsigned long)jobLeft);
+  }
+  else if (jobStatus == COPY_JOB)
+  {
+    replyPart(211, "Copied %lu of %lu bytes in %lu ms", (unsigned long)(jobFirst - jobLeft),
+              (unsigned long)jobFirst, (unsigned long)(millis() - millisBeginJob));
+  }
+  else if (jobStatus == RMDIR_JOB)
+  {
+    replyPart(211, "Removed %lu files and %lu directories in %lu ms", (unsigned long)jobFiles,
+              (unsigned long)jobDirs, (unsigned long)(millis() - millisBeginJob));
+  }
+  else
+  {
+    replyPart(211, "No transfer");
+  }
+  reply(211, "End");
   return true;
 }
 //
 //  RETR - Retrieve
 //
-bool FtpServer::command_RETR()
+bool FtpSession::command_RETR()
 {
   char path[FTP_CWD_SIZE];
   if (strlen(parameters) == 0)
-    client.println("501 No file name");
+    reply(501, "No file name");
   else if (makePath(path))
   {
     file = VirtualFS->open(path, "r");
     if (!file)
-      client.println("550 File " + String(parameters) + " not found");
+      reply(550, "File %s not found", parameters);
     else if (!file)
-      client.println("450 Can't open " + String(parameters));
-    else if (!dataConnect())
-      client.println("425 No data connection");
+      reply(450, "Can't open %s", parameters);
+    else if (restartOffset > file.size() || !file.seek(restartOffset, SeekSet))
+    {
+      reply(554, "Invalid restart position");
+      file.close();
+    }
     else
     {
 #ifdef FTP_DEBUG
-      Serial.println("Sending " + String(parameters));
+      Serial.println("Sending " + String(parameters) + " from " + String(restartOffset));
 #endif
-      client.println("150-Connected to port " + String(dataPort));
-      client.println("150 " + String(file.size()) + " bytes to download");
-      millisBeginTrans = millis();
-      bytesTransfered = 0;
-      transferStatus = 1;
+      retrLeft = file.size() - restartOffset;
+      if (rangeEnd < file.size())
+      {
+        retrLeft = rangeEnd + 1 - restartOffset;
+      }
+      openDataConnection(RETRIVE_DATA);
     }
   }
+  restartOffset = 0;
+  rangeEnd = FTP_NO_RANGE;
   return true;
 }
 //
 //  STOR - Store
 //
-bool FtpServer::command_STOR()
+bool FtpSession::command_STOR()
 {
   char path[FTP_CWD_SIZE];
+  uint64_t total, used;
   if (strlen(parameters) == 0)
-    client.println("501 No file name");
+    reply(501, "No file name");
   else if (makePath(path))
   {
-    file = VirtualFS->open(path, "w");
+    if (allocSize > 0 && spaceInfo(&total, &used))
+    {
+      // Refuse before any data is sent if ALLO size doesn't fit
+      uint32_t oldSize = 0;
+      if (VirtualFS->exists(path))
+      {
+        File old = VirtualFS->open(path, "r");
+        oldSize = old.size();
+        old.close();
+      }
+      uint64_t endSize = (uint64_t)restartOffset + allocSize;
+      if (endSize > oldSize && endSize - oldSize > total - used)
+      {
+        reply(552, "Not enough space, %llu bytes available", (unsigned long long)(total - used));
+        restartOffset = 0;
+        rangeEnd = FTP_NO_RANGE;
+        allocSize = 0;
+        return true;
+      }
+    }
+    if (restartOffset == 0)
+    {
+      file = VirtualFS->open(path, "w");
+    }
+    else
+    {
+      // Resume upload: overwrite from restart position
+      file = VirtualFS->open(path, "r+");
+    }
+    _server->_dirCache.invalidate(VirtualFS, path);
     if (!file)
-      client.println("451 Can't open/create " + String(parameters));
-    else if (!dataConnect())
+      reply(451, "Can't open/create %s", parameters);
+    else if (restartOffset > file.size() || !file.seek(restartOffset, SeekSet))
     {
-      client.println("425 No data connection");
+      reply(554, "Invalid restart position");
       file.close();
     }
     else
@@ -785,52 +991,112 @@ bool FtpServer::command_STOR()
 #ifdef FTP_DEBUG
       Serial.println("Receiving " + String(parameters));
 #endif
-      client.println("150 Connected to port " + String(dataPort));
-      millisBeginTrans = millis();
-      bytesTransfered = 0;
-      transferStatus = 2;
+      storeStart = restartOffset;
+      openDataConnection(STORE_DATA);
     }
   }
+  restartOffset = 0;
+  rangeEnd = FTP_NO_RANGE;
+  allocSize = 0;
+  return true;
+}
+//
+//  REST - Restart transfer at given offset
+//
+bool FtpSession::command_REST()
+{
+  char *end;
+  uint32_t offset = strtoul(parameters, &end, 10);
+  if (strlen(parameters) == 0 || *end != 0)
+  {
+    reply(501, "Can't interpret parameters");
+  }
+  else
+  {
+    restartOffset = offset;
+    rangeEnd = FTP_NO_RANGE;
+    reply(350, "Restarting at %lu. Send STORE or RETRIEVE", (unsigned long)restartOffset);
+  }
   return true;
 }
 //
 //  MKD - Make Directory
 //
-bool FtpServer::command_MKD()
+bool FtpSession::command_MKD()
 {
-  client.println("550 Can't create \"" + String(parameters)); // not support on espyet
+  char path[FTP_CWD_SIZE];
+  if (strlen(parameters) == 0)
+  {
+    reply(501, "No directory name");
+  }
+  else if (makePath(path))
+  {
+    if (VirtualFS->exists(path))
+    {
+      reply(550, "\"%s\" already exists", path);
+    }
+    else if (VirtualFS->mkdir(path))
+    {
+      _server->_dirCache.invalidate(VirtualFS, path);
+      reply(257, "\"%s\" created", path);
+    }
+    else
+      reply(550, "Can't create \"%s\"", path);
+  }
   return true;
 }
 //
 //  RMD - Remove a Directory
 //
-bool FtpServer::command_RMD()
+bool FtpSession::command_RMD()
 {
-  client.println("501 Can't delete \"" + String(parameters));
+  char path[FTP_CWD_SIZE];
+  if (strlen(parameters) == 0)
+  {
+    reply(501, "No directory name");
+  }
+  else if (makePath(path))
+  {
+    if (strcmp(path, "/") == 0)
+    {
+      reply(550, "Can't remove root directory");
+    }
+    else if (!isDirectory(path))
+    {
+      reply(550, "Directory %s not found", parameters);
+    }
+    else if (VirtualFS->rmdir(path))
+    {
+      _server->_dirCache.invalidate(VirtualFS, path);
+      reply(250, "Removed %s", parameters);
+    }
+    else
+      reply(550, "Can't remove %s, is it empty?", parameters);
+  }
   return true;
 }
 //
 //  RNFR - Rename From
 //
-bool FtpServer::command_RNFR()
+bool FtpSession::command_RNFR()
 {
-  buf[0] = 0;
+  rnfrName[0] = 0;
   if (strlen(parameters) == 0)
   {
-    client.println("501 No file name");
+    reply(501, "No file name");
   }
-  else if (makePath(buf))
+  else if (makePath(rnfrName))
   {
-    if (!VirtualFS->exists(buf))
+    if (!VirtualFS->exists(rnfrName))
     {
-      client.println("550 File " + String(parameters) + " not found");
+      reply(550, "File %s not found", parameters);
     }
     else
     {
 #ifdef FTP_DEBUG
-      Serial.println("Renaming " + String(buf));
+      Serial.println("Renaming " + String(rnfrName));
 #endif
-      client.println("350 RNFR accepted - file exists, ready for destination");
+      reply(350, "RNFR accepted - file exists, ready for destination");
       rnfrCmd = true;
     }
   }
@@ -839,27 +1105,31 @@ bool FtpServer::command_RNFR()
 //
 //  RNTO - Rename To
 //
-bool FtpServer::command_RNTO()
+bool FtpSession::command_RNTO()
 {
   char path[FTP_CWD_SIZE];
   char dir[FTP_FIL_SIZE];
-  if (strlen(buf) == 0 || !rnfrCmd)
-    client.println("503 Need RNFR before RNTO");
+  if (strlen(rnfrName) == 0 || !rnfrCmd)
+    reply(503, "Need RNFR before RNTO");
   else if (strlen(parameters) == 0)
-    client.println("501 No file name");
+    reply(501, "No file name");
   else if (makePath(path))
   {
     if (VirtualFS->exists(path))
-      client.println("553 " + String(parameters) + " already exists");
+      reply(553, "%s already exists", parameters);
     else
     {
 #ifdef FTP_DEBUG
-      Serial.println("Renaming " + String(buf) + " to " + String(path));
+      Serial.println("Renaming " + String(rnfrName) + " to " + String(path));
 #endif
-      if (VirtualFS->rename(buf, path))
-        client.println("250 File successfully renamed or moved");
+      if (VirtualFS->rename(rnfrName, path))
+      {
+        _server->_dirCache.invalidate(VirtualFS, rnfrName);
+        _server->_dirCache.invalidate(VirtualFS, path);
+        reply(250, "File successfully renamed or moved");
+      }
       else
-        client.println("451 Rename/move failure");
+        reply(451, "Rename/move failure");
     }
   }
   rnfrCmd = false;
@@ -873,315 +1143,1886 @@ bool FtpServer::command_RNTO()
 ///////////////////////////////////////
 
 //
-//  FEAT - New Features
-//
-
-bool FtpServer::command_FEAT()
-{
-  client.println("211-Extensions suported:");
-  client.println(" MLSD");
-  client.println("211 End.");
-  return true;
-}
-//
-//  MDTM - File Modification Time (see RFC 3659)
+//  AVBL - Available space (see draft-peterson-streamlined-ftp-command-extensions)
 //
-bool FtpServer::command_MDTM()
+bool FtpSession::command_AVBL()
 {
-  client.println("550 Unable to retrieve time");
+  uint64_t total, used;
+  if (!spaceInfo(&total, &used))
+    reply(550, "Free space unknown");
+  else
+    reply(213, "%llu", (unsigned long long)(total - used));
   return true;
 }
 //
-//  SIZE - Size of the file
+//  FEAT - New Features
 //
-bool FtpServer::command_SIZE()
+
+bool FtpSession::command_FEAT()
 {
-  char path[FTP_CWD_SIZE];
-  if (strlen(parameters) == 0)
-  {
-    client.println("501 No file name");
-  }
-  else if (makePath(path))
+  replyPart(211, "Extensions suported:");
+  replyText(" AVBL");
+  char hash[48] = " HASH ";
+  for (uint8_t i = 0; i < HASH_COUNT; i++)
   {
-    file = VirtualFS->open(path, "r");
-    if (!file)
-    {
-      client.println("450 Can't open " + String(parameters));
-    }
-    else
-    {
-      client.println("213 " + String(file.size()));
-      file.close();
-    }
+    strcat(hash, FtpHash::name(i));
+    strcat(hash, i == hashAlgo ? "*;" : ";");
   }
+  hash[strlen(hash) - 1] = 0;
+  replyText(hash);
+  replyText(" MDTM");
+#ifdef ESP8266
+  replyText(" MFMT");
+#endif
+  replyText(" MLSD");
+  replyText(" MLST Type*;Size*;Modify*;");
+  replyText(" MODE Z");
+  replyText(" REST STREAM");
+  replyText(" RANG STREAM");
+  replyText(" SIZE");
+  replyText(" XCRC");
+  replyText(" XMD5");
+  replyText(" XSHA1");
+  replyText(" XSHA256");
+  reply(211, "End.");
   return true;
 }
 //
-//  SITE - System command
+//  HASH - Digest of a file (see draft-bryan-ftp-hash)
+//
+//  the file is read in background by doJob(), reply comes when it is done
 //
-bool FtpServer::command_SITE()
+bool FtpSession::command_HASH()
 {
-  client.println("500 Unknow SITE command " + String(parameters));
-  return true;
+  return startHash(hashAlgo, 213);
 }
-
 //
-//  Unrecognized commands ...
+//  XCRC, XMD5, XSHA1, XSHA256 - Digest of a whole file with an algorithm
 //
-bool FtpServer::command_Unrecognized()
+bool FtpSession::command_XCRC()
 {
-  client.println("500 Unknow command");
-  return true;
+  return startHash(HASH_CRC32, 250);
 }
 
-boolean FtpServer::processCommand()
+bool FtpSession::command_XMD5()
 {
-  ///////////////////////////////////////
-  //                                   //
-  //      ACCESS CONTROL COMMANDS      //
-  //                                   //
-  ///////////////////////////////////////
-  typedef bool (FtpServer::*CommandHandler)();
-  typedef struct
-  {
-    const char *name;
-    CommandHandler handler;
-  } Command_t;
-
-  const Command_t commandTable[25] = {
-      {"CDUP", &FtpServer::command_CDUP},
-      {"CWD", &FtpServer::command_CWD},
-      {"PWD", &FtpServer::command_PWD},
-      {"QUIT", &FtpServer::command_QUIT},
-      {"MODE", &FtpServer::command_MODE},
-      {"PASV", &FtpServer::command_PASV},
-      {"PORT", &FtpServer::command_PORT},
-      {"STRU", &FtpServer::command_STRU},
-      {"TYPE", &FtpServer::command_TYPE},
-      {"ABOR", &FtpServer::command_ABOR},
-      {"DELE", &FtpServer::command_DELE},
-      {"LIST", &FtpServer::command_LIST},
-      {"MLSD", &FtpServer::command_MLSD},
-      {"NLST", &FtpServer::command_NLST},
-      {"NOOP", &FtpServer::command_NOOP},
-      {"RETR", &FtpServer::command_RETR},
-      {"STOR", &FtpServer::command_STOR},
-      {"MKD", &FtpServer::command_MKD},
-      {"RMD", &FtpServer::command_RMD},
-      {"RNFR", &FtpServer::command_RNFR},
-      {"RNTO", &FtpServer::command_RNTO},
-      {"FEAT", &FtpServer::command_FEAT},
-      {"MDTM", &FtpServer::command_MDTM},
-      {"SIZE", &FtpServer::command_SIZE},
-      {"SITE", &FtpServer::command_SITE},
-  };
-
-  for (const Command_t &cmd : commandTable)
-  {
-    if (cmd.name && !strcmp(command, cmd.name))
-    {
-      return (this->*(cmd.handler))();
-    }
-  }
-  return command_Unrecognized();
-}
-
-boolean FtpServer::dataConnect()
-{
-  unsigned long startTime = millis();
-  // wait 5 seconds for a data connection
-  if (!data.connected())
-  {
-    while (!dataServer.hasClient() && millis() - startTime < 10000)
-    {
-      // delay(100);
-      yield();
-    }
-    if (dataServer.hasClient())
-    {
-      data.stop();
-      data = dataServer.accept();
-#ifdef FTP_DEBUG
-      Serial.println("ftpdataserver client....");
-#endif
-    }
-  }
+  return startHash(HASH_MD5, 250);
+}
 
-  return data.connected();
+bool FtpSession::command_XSHA1()
+{
+  return startHash(HASH_SHA1, 250);
 }
 
-boolean FtpServer::doRetrieve()
+bool FtpSession::command_XSHA256()
 {
-  if (data.connected())
+  return startHash(HASH_SHA256, 250);
+}
+//
+//  OPTS - Options of a command, only HASH has some
+//
+bool FtpSession::command_OPTS()
+{
+  if (strncasecmp(parameters, "HASH", 4) != 0 || (parameters[4] != 0 && parameters[4] != ' '))
   {
-    int16_t nb = file.readBytes(buf, FTP_BUF_SIZE);
-    if (nb > 0)
+    reply(501, "Option not understood");
+    return true;
+  }
+  char *name = parameters + 4;
+  while (*name == ' ')
+    name++;
+  if (*name != 0)
+  {
+    int8_t algo = FtpHash::find(name);
+    if (algo < 0)
     {
-      data.write((uint8_t *)buf, nb);
-      bytesTransfered += nb;
+      reply(501, "Unknown algorithm, current selection not changed");
       return true;
     }
+    hashAlgo = algo;
   }
-  closeTransfer();
-  return false;
+  reply(200, "%s", FtpHash::name(hashAlgo));
+  return true;
 }
-
-boolean FtpServer::doStore()
+//
+//  RANG - Byte range of next RETR (see draft-bryan-ftp-range)
+//
+bool FtpSession::command_RANG()
 {
-  // Avoid blocking by never reading more bytes than are available
-  int navail = data.available();
-
-  if (navail > 0)
-  {
-    // And be sure not to overflow buf.
-    if (navail > FTP_BUF_SIZE)
-      navail = FTP_BUF_SIZE;
-    int16_t nb = data.read((uint8_t *)buf, navail);
-    // int16_t nb = data.readBytes((uint8_t*) buf, FTP_BUF_SIZE );
-    if (nb > 0)
-    {
-      // Serial.println( millis() << " " << nb << endl;
-      file.write((uint8_t *)buf, nb);
-      bytesTransfered += nb;
-    }
-  }
-  if (!data.connected() && (navail <= 0))
+  char *end;
+  uint32_t first = strtoul(parameters, &end, 10);
+  uint32_t last = (*end == ' ') ? strtoul(end + 1, &end, 10) : 0;
+  if (strlen(parameters) == 0 || *end != 0)
   {
-    closeTransfer();
-    return false;
+    reply(501, "Can't interpret parameters");
   }
-  else
+  else if (first == 1 && last == 0)
   {
-    return true;
+    // "RANG 1 0" resets the range
+    restartOffset = 0;
+    rangeEnd = FTP_NO_RANGE;
+    reply(350, "Restarting at 0. Range reset");
   }
-}
-
-void FtpServer::closeTransfer()
-{
-  uint32_t deltaT = (int32_t)(millis() - millisBeginTrans);
-  if (deltaT > 0 && bytesTransfered > 0)
+  else if (last < first)
   {
-    client.println("226-File successfully transferred");
-    client.println("226 " + String(deltaT) + " ms, " + String(bytesTransfered / deltaT) + " kbytes/s");
+    reply(501, "End of range is before start");
   }
   else
-    client.println("226 File successfully transferred");
-
-  file.close();
-  data.stop();
-}
-
-void FtpServer::abortTransfer()
-{
-  if (transferStatus > 0)
   {
-    file.close();
-    data.stop();
-    client.println("426 Transfer aborted");
-#ifdef FTP_DEBUG
-    Serial.println("Transfer aborted!");
-#endif
+    restartOffset = first;
+    rangeEnd = last;
+    reply(350, "Restarting at %lu. Ending at %lu.", (unsigned long)first, (unsigned long)last);
   }
-  transferStatus = 0;
+  return true;
 }
-
-// Read a char from client connected to ftp server
 //
-//  update cmdLine and command buffers, iCL and parameters pointers
+//  MDTM - File Modification Time (see RFC 3659)
 //
-//  return:
-//    -2 if buffer cmdLine is full
-//    -1 if line not completed
-//     0 if empty line received
-//    length of cmdLine (positive) if no empty line received
-
-int8_t FtpServer::readChar()
+//  "MDTM YYYYMMDDHHMMSS file", sent by some clients to set the time, is
+//  the same as MFMT
+//
+bool FtpSession::command_MDTM()
 {
-  int8_t rc = -1;
-
-  if (client.available())
+  char path[FTP_CWD_SIZE];
+  uint16_t year;
+  uint8_t month, day, hour, minute, second;
+  if (getDateTime(&year, &month, &day, &hour, &minute, &second) > 0)
   {
-    char c = client.read();
-    // char c;
-    // client.readBytes((uint8_t*) c, 1);
-#ifdef FTP_DEBUG
-    Serial.print(c);
-#endif
-    if (c == '\\')
+    return command_MFMT();
+  }
+  if (strlen(parameters) == 0)
+  {
+    reply(501, "No file name");
+  }
+  else if (makePath(path))
+  {
+    char modify[15];
+    DirCacheEntry_t entry;
+    if (_server->_dirCache.find(VirtualFS, path, &entry) && !entry.isDir)
     {
-      c = '/';
+      EpochToISO(entry.time, modify, sizeof(modify));
+      reply(213, "%s", modify);
+      return true;
     }
-    if (c != '\r')
+    File mdtmFile = VirtualFS->open(path, "r");
+    if (!mdtmFile || mdtmFile.isDirectory())
     {
-      if (c != '\n')
-      {
-        if (iCL < FTP_CMD_SIZE)
-          cmdLine[iCL++] = c;
-        else
-          rc = -2; //  Line too long
-      }
-      else
-      {
-        cmdLine[iCL] = 0;
-        command[0] = 0;
-        parameters = NULL;
-        // empty line?
-        if (iCL == 0)
-          rc = 0;
-        else
-        {
-          rc = iCL;
-          // search for space between command and parameters
-          parameters = strchr(cmdLine, ' ');
-          if (parameters != NULL)
-          {
-            if (parameters - cmdLine > 4)
-              rc = -2; // Syntax error
-            else
-            {
-              strncpy(command, cmdLine, parameters - cmdLine);
-              command[parameters - cmdLine] = 0;
-
-              while (*(++parameters) == ' ')
-                ;
-            }
-          }
-          else if (strlen(cmdLine) > 4)
-            rc = -2; // Syntax error.
-          else
-            strcpy(command, cmdLine);
-          iCL = 0;
-        }
-      }
+      reply(550, "File %s not found", parameters);
     }
-    if (rc > 0)
-      for (uint8_t i = 0; i < strlen(command); i++)
-        command[i] = toupper(command[i]);
-    if (rc == -2)
+    else
     {
-      iCL = 0;
-      client.println("500 Syntax error");
+      EpochToISO(mdtmFile.getLastWrite(), modify, sizeof(modify));
+      reply(213, "%s", modify);
     }
+    mdtmFile.close();
   }
-  return rc;
+  return true;
 }
 
-// Make complete path/name from cwdName and parameters
-//
-// 3 possible cases: parameters can be absolute path, relative path or only the name
-//
-// parameters:
-//   fullName : where to store the path/name
-//
-// return:
-//    true, if done
+#ifdef ESP8266
+// Time of MFMT, given to the file by the time callback of the file system
+static time_t mfmtTime;
 
-boolean FtpServer::makePath(char *fullName)
+static time_t mfmtTimeCallback()
 {
-  return makePath(fullName, parameters);
+  return mfmtTime;
 }
 
-boolean FtpServer::makePath(char *fullName, char *param)
+// Seconds since 1970-01-01 of an UTC date and time
+static time_t epochOf(uint16_t year, uint8_t month, uint8_t day,
+                      uint8_t hour, uint8_t minute, uint8_t second)
+{
+  // Days from civil date, years begin in March so leap day is last
+  uint32_t y = year - (month <= 2);
+  uint32_t era = y / 400;
+  uint32_t yoe = y - era * 400;
+  uint32_t doy = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+  uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  int64_t days = (int64_t)era * 146097 + doe - 719468;
+  return (time_t)(days * 86400 + hour * 3600l + minute * 60 + second);
+}
+#endif
+//
+//  MFMT - Modify Fact: Modification Time (see draft-somers-ftp-mfxx)
+//
+bool FtpSession::command_MFMT()
+{
+  char path[FTP_CWD_SIZE];
+  uint16_t year;
+  uint8_t month, day, hour, minute, second;
+  uint8_t len = getDateTime(&year, &month, &day, &hour, &minute, &second);
+  if (len == 0)
+  {
+    reply(501, "Can't interpret parameters");
+    return true;
+  }
+  if (!makePath(path, parameters + len))
+  {
+    return true;
+  }
+  File mfmtFile = VirtualFS->open(path, "r");
+  if (!mfmtFile || mfmtFile.isDirectory())
+  {
+    reply(550, "File %s not found", parameters + len);
+    mfmtFile.close();
+    return true;
+  }
+  mfmtFile.close();
+#ifdef ESP8266
+  // LittleFS stamps a file opened for writing when it is closed, SdFat
+  //   only a file written to, so the time kept is checked after
+  mfmtTime = epochOf(year, month, day, hour, minute, second);
+  mfmtFile = VirtualFS->open(path, "r+");
+  if (!mfmtFile)
+  {
+    reply(550, "Can't set time of %s", parameters + len);
+    return true;
+  }
+  mfmtFile.setTimeCallback(mfmtTimeCallback);
+  mfmtFile.close();
+  _server->_dirCache.invalidate(VirtualFS, path);
+
+  // Reply the time kept, FAT has a resolution of 2 seconds
+  char modify[15];
+  mfmtFile = VirtualFS->open(path, "r");
+  time_t kept = mfmtFile.getLastWrite();
+  mfmtFile.close();
+  if (kept < mfmtTime - 2 || kept > mfmtTime + 2)
+  {
+    reply(550, "Can't set time of %s", parameters + len);
+    return true;
+  }
+  EpochToISO(kept, modify, sizeof(modify));
+  reply(213, "Modify=%s; %s", modify, parameters + len);
+#elif defined ESP32
+  // fs::File of ESP32 has no way to set the time
+  reply(550, "Can't set time of %s", parameters + len);
+#endif
+  return true;
+}
+//
+//  MLST - Facts of a file or directory, on control connection (see RFC 3659)
+//
+bool FtpSession::command_MLST()
+{
+  char path[FTP_CWD_SIZE];
+  char facts[FTP_REPLY_SIZE];
+  if (!makePath(path, strlen(parameters) == 0 ? cwdName : parameters))
+  {
+    return true;
+  }
+  File mlstFile = VirtualFS->open(path, "r");
+  if (!mlstFile && strcmp(path, "/") != 0)
+  {
+    reply(550, "%s not found", path);
+    return true;
+  }
+  facts[0] = ' ';
+  int len = FtpDirList::formatFacts(facts + 1, sizeof(facts) - 1, path,
+                                    mlstFile.isDirectory() ? 0 : mlstFile.size(),
+                                    mlstFile ? mlstFile.getLastWrite() : 0,
+                                    !mlstFile || mlstFile.isDirectory());
+  mlstFile.close();
+  if (len < 0 || (size_t)len >= sizeof(facts) - 1)
+  {
+    reply(501, "Path too long");
+    return true;
+  }
+  replyPart(250, "Listing %s", path);
+  replyText(facts);
+  reply(250, "End.");
+  return true;
+}
+//
+//  SIZE - Size of the file
+//
+bool FtpSession::command_SIZE()
+{
+  char path[FTP_CWD_SIZE];
+  if (strlen(parameters) == 0)
+  {
+    reply(501, "No file name");
+  }
+  else if (makePath(path))
+  {
+    DirCacheEntry_t entry;
+    if (_server->_dirCache.find(VirtualFS, path, &entry) && !entry.isDir)
+    {
+      reply(213, "%lu", (unsigned long)entry.size);
+      return true;
+    }
+    file = VirtualFS->open(path, "r");
+    if (!file)
+    {
+      reply(450, "Can't open %s", parameters);
+    }
+    else
+    {
+      reply(213, "%lu", (unsigned long)file.size());
+      file.close();
+    }
+  }
+  return true;
+}
+//
+//  SITE - System command
+//
+bool FtpSession::command_SITE()
+{
+  uint64_t total, used;
+  if (!strcasecmp(parameters, "DF"))
+  {
+    if (!spaceInfo(&total, &used))
+      reply(550, "Free space unknown");
+    else
+      reply(200, "%llu bytes free of %llu", (unsigned long long)(total - used), (unsigned long long)total);
+  }
+  else if (!strncasecmp(parameters, "CPFR ", 5))
+  {
+    siteCopyFrom(parameters + 5);
+  }
+  else if (!strncasecmp(parameters, "CPTO ", 5))
+  {
+    siteCopyTo(parameters + 5);
+  }
+  else if (!strncasecmp(parameters, "RMDIR -r ", 9))
+  {
+    siteRemoveTree(parameters + 9);
+  }
+  else if (!strcasecmp(parameters, "STATS"))
+  {
+    FtpStats &stats = _server->_stats;
+    char histogram[FTP_STATS_TEXT_SIZE];
+    stats.commandTime.format(histogram, sizeof(histogram));
+    replyPart(200, "Commands: %lu, %s", (unsigned long)stats.commands, histogram);
+    replyPart(200, "Transfers: %lu, %lu failed", (unsigned long)stats.transfers, (unsigned long)stats.failedTransfers);
+    replyPart(200, "Bytes: %llu sent, %llu received",
+              (unsigned long long)stats.bytesSent, (unsigned long long)stats.bytesReceived);
+    replyPart(200, "Last transfer: %lu bytes in %lu ms, %lu network stalls, %lu us in file system",
+              (unsigned long)stats.last.bytes, (unsigned long)stats.last.durationMs,
+              (unsigned long)stats.last.netStalls, (unsigned long)stats.last.fsMicros);
+    stats.handleTime.format(histogram, sizeof(histogram));
+    replyPart(200, "handleFTP(): %s", histogram);
+    if (tuner().size() > 0)
+    {
+      replyPart(200, "RETR reads: %u bytes%s", tuner().size(), tuner().tuning() ? " (tuning)" : "");
+    }
+    SDContention_t sd = sdControl.contention();
+    replyPart(200, "SD bus: %lu grants, %lu waits for %lu ms, blockout %lu ms after %lu edges in %lu bursts, %lu collisions",
+              (unsigned long)sd.grants, (unsigned long)sd.denials, (unsigned long)sd.blockedMs,
+              (unsigned long)sd.blockoutMs, (unsigned long)sd.edges, (unsigned long)sd.bursts,
+              (unsigned long)sd.collisions);
+    reply(200, "End");
+  }
+  else
+    reply(500, "Unknow SITE command %s", parameters);
+  return true;
+}
+
+//
+//  Unrecognized commands ...
+//
+bool FtpSession::command_Unrecognized()
+{
+  reply(500, "Unknow command");
+  return true;
+}
+
+// Pack a command of up to FTP_VERB_SIZE (7) chars in an integer, so
+//   commands can be used as case labels and matched with a single compare
+static constexpr uint64_t ftpVerb(const char *name, uint64_t verb = 0)
+{
+  return (*name == 0) ? verb : ftpVerb(name + 1, (verb << 8) | (uint8_t)*name);
+}
+
+// Session states a command is accepted in
+static constexpr uint8_t IN_LOGIN = (1u << WAIT_FOR_USER_IDENTITY) | (1u << WAIT_FOR_USER_PASSWORD);
+static constexpr uint8_t IN_PASSWORD = (1u << WAIT_FOR_USER_PASSWORD);
+static constexpr uint8_t IN_SESSION = (1u << WAIT_FOR_USER_COMMAND);
+static constexpr uint8_t IN_ANY = IN_LOGIN | IN_SESSION;
+
+FtpSession::Command_t FtpSession::findCommand(uint64_t verb)
+{
+  switch (verb)
+  {
+  ///////////////////////////////////////
+  //                                   //
+  //      ACCESS CONTROL COMMANDS      //
+  //                                   //
+  ///////////////////////////////////////
+  case ftpVerb("USER"):
+    return {&FtpSession::command_USER, IN_LOGIN};
+  case ftpVerb("PASS"):
+    return {&FtpSession::command_PASS, IN_PASSWORD};
+  case ftpVerb("CDUP"):
+    return {&FtpSession::command_CDUP, IN_SESSION};
+  case ftpVerb("CWD"):
+    return {&FtpSession::command_CWD, IN_SESSION};
+  case ftpVerb("PWD"):
+    return {&FtpSession::command_PWD, IN_SESSION};
+  case ftpVerb("QUIT"):
+    return {&FtpSession::command_QUIT, IN_ANY};
+
+  ///////////////////////////////////////
+  //                                   //
+  //    TRANSFER PARAMETER COMMANDS    //
+  //                                   //
+  ///////////////////////////////////////
+  case ftpVerb("MODE"):
+    return {&FtpSession::command_MODE, IN_SESSION};
+  case ftpVerb("PASV"):
+    return {&FtpSession::command_PASV, IN_SESSION};
+  case ftpVerb("EPSV"):
+    return {&FtpSession::command_EPSV, IN_SESSION};
+  case ftpVerb("PORT"):
+    return {&FtpSession::command_PORT, IN_SESSION};
+  case ftpVerb("STRU"):
+    return {&FtpSession::command_STRU, IN_SESSION};
+  case ftpVerb("TYPE"):
+    return {&FtpSession::command_TYPE, IN_SESSION};
+
+  ///////////////////////////////////////
+  //                                   //
+  //        FTP SERVICE COMMANDS       //
+  //                                   //
+  ///////////////////////////////////////
+  case ftpVerb("ABOR"):
+    return {&FtpSession::command_ABOR, IN_SESSION};
+  case ftpVerb("ALLO"):
+    return {&FtpSession::command_ALLO, IN_SESSION};
+  case ftpVerb("DELE"):
+    return {&FtpSession::command_DELE, IN_SESSION};
+  case ftpVerb("LIST"):
+    return {&FtpSession::command_LIST, IN_SESSION};
+  case ftpVerb("MLSD"):
+    return {&FtpSession::command_MLSD, IN_SESSION};
+  case ftpVerb("NLST"):
+    return {&FtpSession::command_NLST, IN_SESSION};
+  case ftpVerb("NOOP"):
+    return {&FtpSession::command_NOOP, IN_ANY};
+  case ftpVerb("STAT"):
+    return {&FtpSession::command_STAT, IN_SESSION};
+  case ftpVerb("RETR"):
+    return {&FtpSession::command_RETR, IN_SESSION};
+  case ftpVerb("STOR"):
+    return {&FtpSession::command_STOR, IN_SESSION};
+  case ftpVerb("REST"):
+    return {&FtpSession::command_REST, IN_SESSION};
+  case ftpVerb("MKD"):
+    return {&FtpSession::command_MKD, IN_SESSION};
+  case ftpVerb("RMD"):
+    return {&FtpSession::command_RMD, IN_SESSION};
+  case ftpVerb("RNFR"):
+    return {&FtpSession::command_RNFR, IN_SESSION};
+  case ftpVerb("RNTO"):
+    return {&FtpSession::command_RNTO, IN_SESSION};
+
+  ///////////////////////////////////////
+  //                                   //
+  //   EXTENSIONS COMMANDS (RFC 3659)  //
+  //                                   //
+  ///////////////////////////////////////
+  case ftpVerb("AVBL"):
+    return {&FtpSession::command_AVBL, IN_SESSION};
+  case ftpVerb("FEAT"):
+    return {&FtpSession::command_FEAT, IN_ANY};
+  case ftpVerb("RANG"):
+    return {&FtpSession::command_RANG, IN_SESSION};
+  case ftpVerb("HASH"):
+    return {&FtpSession::command_HASH, IN_SESSION};
+  case ftpVerb("XCRC"):
+    return {&FtpSession::command_XCRC, IN_SESSION};
+  case ftpVerb("XMD5"):
+    return {&FtpSession::command_XMD5, IN_SESSION};
+  case ftpVerb("XSHA1"):
+    return {&FtpSession::command_XSHA1, IN_SESSION};
+  case ftpVerb("XSHA256"):
+    return {&FtpSession::command_XSHA256, IN_SESSION};
+  case ftpVerb("OPTS"):
+    return {&FtpSession::command_OPTS, IN_SESSION};
+  case ftpVerb("MDTM"):
+    return {&FtpSession::command_MDTM, IN_SESSION};
+  case ftpVerb("MFMT"):
+    return {&FtpSession::command_MFMT, IN_SESSION};
+  case ftpVerb("MLST"):
+    return {&FtpSession::command_MLST, IN_SESSION};
+  case ftpVerb("SIZE"):
+    return {&FtpSession::command_SIZE, IN_SESSION};
+  case ftpVerb("SITE"):
+    return {&FtpSession::command_SITE, IN_SESSION};
+  }
+  return {&FtpSession::command_Unrecognized, IN_ANY};
+}
+
+// Execute command received from client
+//
+// return:
+//    false if client must be disconnected
+
+boolean FtpSession::processCommand()
+{
+  const Command_t cmd = findCommand(ftpVerb(command));
+
+  if (!(cmd.states & (1u << cmdStatus)))
+  {
+    if (cmdStatus == WAIT_FOR_USER_COMMAND)
+      reply(503, "Already logged in");
+    else if (cmd.states == IN_PASSWORD)
+      reply(503, "Login with USER first");
+    else
+      reply(530, "Please login with USER and PASS");
+    return true;
+  }
+  return (this->*(cmd.handler))();
+}
+
+// Wait for a data connection for the given transfer
+//
+//  the connection is checked on each handle() call until it is
+//  established or FTP_DATA_TIME_OUT expires, see waitDataConnection()
+
+void FtpSession::openDataConnection(int8_t transfer)
+{
+  transferStatus = transfer;
+  dataWait = true;
+  millisEndData = millis() + (uint32_t)FTP_DATA_TIME_OUT * 1000;
+  if (pasv == nullptr && !data.connected())
+  {
+    // No PASV or EPSV before, nothing will connect
+    millisEndData = millis();
+  }
+}
+
+// Check for a data connection without blocking
+//
+// return:
+//    true if data connection is established
+
+boolean FtpSession::dataConnect()
+{
+  if (!data.connected() && pasv != nullptr && pasv->server.hasClient())
+  {
+    data.stop();
+    data = pasv->server.accept();
+#ifdef FTP_DEBUG
+    Serial.println("ftpdataserver client....");
+#endif
+  }
+
+  return data.connected();
+}
+
+// Advance a pending data connection
+//
+// return:
+//    false if no data connection came in time and the transfer is dropped
+
+boolean FtpSession::waitDataConnection()
+{
+  if (dataConnect())
+  {
+    dataWait = false;
+    if (modeZ && !beginModeZ())
+    {
+      reply(451, "Not enough memory for MODE Z");
+      file.close();
+      dirList.end();
+      data.stop();
+      return false;
+    }
+    if (transferStatus == RETRIVE_DATA)
+    {
+      replyPart(150, "Connected to port %u", dataPort);
+      reply(150, "%lu bytes to download", (unsigned long)retrLeft);
+    }
+    else if (transferStatus == STORE_DATA)
+    {
+      reply(150, "Connected to port %u", dataPort);
+    }
+    else
+    {
+      reply(150, "Accepted data connection");
+    }
+    retrHead = 0;
+    retrCount = 0;
+    retrPos = 0;
+    retrEof = false;
+    storeLen = 0;
+    fsBlock = fsBlockSize();
+    tuner().begin(fsBlock, FTP_RETR_CHUNK);
+    retrRead = tuner().size();
+    millisBeginTrans = millis();
+    bytesTransfered = 0;
+    netStalls = 0;
+    fsMicros = 0;
+    return true;
+  }
+
+  if ((int32_t)(millisEndData - millis()) > 0)
+  {
+    return true;
+  }
+
+  reply(425, "No data connection");
+  file.close();
+  dirList.end();
+  dataWait = false;
+  return false;
+}
+
+// Send next part of directory listing
+//
+// return:
+//    false when listing is completed or data connection is lost
+
+boolean FtpSession::doList()
+{
+  if (modeZ)
+  {
+    // Compressed listing goes through the RETR pipeline
+    return doRetrieve();
+  }
+  if (!data.connected())
+  {
+    reply(426, "Connection closed; transfer aborted");
+    dirList.end();
+    return false;
+  }
+  boolean more = dirList.send(data, buf, FTP_BUF_SIZE);
+  bytesTransfered = dirList.bytes();
+  if (more)
+  {
+    return true;
+  }
+  closeTransfer();
+  return false;
+}
+
+// Room in the TCP send window of the data connection
+//
+//  ESP32 WiFiClient doesn't report it, there write() blocks until sent
+
+size_t FtpSession::dataWriteRoom()
+{
+#ifdef ESP32
+  return FTP_RETR_CHUNK;
+#else
+  return data.availableForWrite();
+#endif
+}
+
+// Allocate compressor or decompressor of a MODE Z transfer
+//
+// return:
+//    false if there is not enough memory
+
+boolean FtpSession::beginModeZ()
+{
+  if (transferStatus == STORE_DATA)
+  {
+    return inflater.begin();
+  }
+  return deflater.begin();
+}
+
+// Compress next part of file or listing in out
+//
+// return:
+//    bytes written in out, 0 once compressed stream is completed
+
+size_t FtpSession::deflateChunk(uint8_t *out, size_t size)
+{
+  size_t len = 0;
+  while (len < size && !deflater.finished())
+  {
+    size_t room;
+    uint8_t *in = deflater.inputBuffer(&room);
+    size_t nb;
+    boolean finish;
+    if (transferStatus == LIST_DATA)
+    {
+      nb = dirList.fill((char *)in, room);
+      finish = dirList.eof();
+    }
+    else
+    {
+      size_t want = room < retrLeft ? room : retrLeft;
+      uint32_t start = micros();
+      nb = file.read(in, want);
+      fsMicros += micros() - start;
+      retrLeft -= nb;
+      finish = retrLeft == 0 || nb < want;
+    }
+    deflater.commitInput(nb);
+    size_t nz = deflater.deflate(out + len, size - len, finish);
+    len += nz;
+    if (nb == 0 && nz == 0 && !deflater.finished())
+    {
+      break; // out is full
+    }
+  }
+  return len;
+}
+
+// Send file in pipeline: buffered chunks are handed to TCP no faster than
+//   the send window takes them, then the next free buffer is read from the
+//   file while TCP is sending
+//
+// return:
+//    false when transfer is completed or data connection is lost
+
+boolean FtpSession::doRetrieve()
+{
+  if (!data.connected())
+  {
+    closeTransfer();
+    return false;
+  }
+
+  while (retrCount > 0)
+  {
+    size_t room = dataWriteRoom();
+    if (room == 0)
+    {
+      netStalls++;
+      break;
+    }
+    char *chunk = buf + retrHead * FTP_RETR_CHUNK;
+    size_t nb = retrLen[retrHead] - retrPos;
+    if (nb > room)
+    {
+      nb = room;
+    }
+    nb = data.write((uint8_t *)chunk + retrPos, nb);
+    if (nb == 0)
+    {
+      break;
+    }
+    retrPos += nb;
+    bytesTransfered += nb;
+    if (retrPos == retrLen[retrHead])
+    {
+      retrHead = (retrHead + 1) % FTP_RETR_BUFFERS;
+      retrCount--;
+      retrPos = 0;
+    }
+  }
+
+  if (!retrEof && retrCount < FTP_RETR_BUFFERS)
+  {
+    uint8_t slot = (retrHead + retrCount) % FTP_RETR_BUFFERS;
+    int16_t nb = FTP_RETR_CHUNK;
+    if (modeZ)
+    {
+      nb = deflateChunk((uint8_t *)buf + slot * FTP_RETR_CHUNK, FTP_RETR_CHUNK);
+    }
+    else
+    {
+      // Up to a block boundary, after REST the first read is shorter
+      nb = retrRead - file.position() % fsBlock;
+      if (retrLeft < (uint32_t)nb)
+      {
+        nb = retrLeft;
+      }
+      if (nb > 0)
+      {
+        uint32_t start = micros();
+        nb = file.readBytes(buf + slot * FTP_RETR_CHUNK, nb);
+        fsMicros += micros() - start;
+        retrLeft -= nb;
+      }
+    }
+    if (nb > 0)
+    {
+      retrLen[slot] = nb;
+      retrCount++;
+    }
+    else
+    {
+      retrEof = true;
+    }
+  }
+
+  if (retrEof && retrCount == 0)
+  {
+    closeTransfer();
+    return false;
+  }
+  return true;
+}
+
+// Receive file: data is collected in buf and written to file by whole
+//   blocks of the file system, so partial sectors are not rewritten
+//
+// return:
+//    false when transfer is completed or data connection is lost
+
+boolean FtpSession::doStore()
+{
+  // Avoid blocking by never reading more bytes than are available
+  int navail = data.available();
+
+  if (navail > 0)
+  {
+    // And be sure not to overflow buf. In MODE Z, compressed data is read
+    //   in the second half of buf, the first half keeps what is to write
+    char *in = modeZ ? buf + FTP_RETR_CHUNK : buf + storeLen;
+    int16_t room = modeZ ? FTP_RETR_CHUNK : FTP_BUF_SIZE - storeLen;
+    if (navail > room)
+      navail = room;
+    int16_t nb = data.read((uint8_t *)in, navail);
+    // int16_t nb = data.readBytes((uint8_t*) buf, FTP_BUF_SIZE );
+    if (nb > 0)
+    {
+      // Serial.println( millis() << " " << nb << endl;
+      bytesTransfered += nb;
+      if (!modeZ)
+      {
+        storeLen += nb;
+        if (storeLen == FTP_BUF_SIZE)
+        {
+          storeFlush(false);
+        }
+      }
+      else if (!inflateToFile((uint8_t *)in, nb))
+      {
+        // Drop the upload, closeTransfer() reports it
+        data.stop();
+        navail = 0;
+      }
+    }
+  }
+  else if (data.connected())
+  {
+    netStalls++;
+  }
+  if (!data.connected() && (navail <= 0))
+  {
+    closeTransfer();
+    return false;
+  }
+  else
+  {
+    return true;
+  }
+}
+
+// Open file named by parameters and start computing its digest
+//
+//  HASH honors a byte range set by REST or RANG, the X commands hash the
+//  whole file
+//
+// return:
+//    true, the session goes on whatever happens
+
+boolean FtpSession::startHash(uint8_t algo, uint16_t code)
+{
+  char path[FTP_CWD_SIZE];
+  if (jobStatus != NO_JOB)
+  {
+    reply(450, "Busy computing another digest");
+  }
+  else if (strlen(parameters) == 0)
+  {
+    reply(501, "No file name");
+  }
+  else if (makePath(path))
+  {
+    jobFile = VirtualFS->open(path, "r");
+    if (!jobFile || jobFile.isDirectory())
+    {
+      jobFile.close();
+      reply(550, "File %s not found", parameters);
+    }
+    else
+    {
+      uint32_t size = jobFile.size();
+      jobFirst = code == 213 ? restartOffset : 0;
+      uint32_t last = code == 213 && rangeEnd < size ? rangeEnd : size - 1;
+      if (jobFirst > size || (jobFirst == size && size > 0))
+      {
+        jobFile.close();
+        reply(554, "Invalid range");
+      }
+      else
+      {
+        jobFile.seek(jobFirst);
+        jobLeft = size > 0 ? last + 1 - jobFirst : 0;
+        hasher.begin(algo);
+        jobReply = code;
+        strcpy(jobName, parameters);
+        jobStatus = HASH_JOB;
+      }
+    }
+  }
+  if (code == 213)
+  {
+    restartOffset = 0;
+    rangeEnd = FTP_NO_RANGE;
+  }
+  return true;
+}
+
+// Run next step of background job of session
+//
+//  a HASH job digests, a COPY job copies FTP_BUF_SIZE bytes of file per
+//  call, a RMDIR job removes up to FTP_RMDIR_STEP entries of a directory
+//
+// return:
+//    bytes read, or entries removed
+
+uint32_t FtpSession::doJob()
+{
+  uint32_t nb = jobLeft < FTP_BUF_SIZE ? jobLeft : FTP_BUF_SIZE;
+  if (jobStatus == RMDIR_JOB)
+  {
+    return removeTreeStep();
+  }
+  if (jobStatus == COPY_JOB)
+  {
+    if (nb > 0)
+    {
+      nb = jobFile.read((uint8_t *)buf, nb);
+      if (nb == 0 || jobOut.write((uint8_t *)buf, nb) != nb)
+      {
+        reply(452, "Copy failed after %lu bytes", (unsigned long)(jobFirst - jobLeft));
+        endCopy(false);
+        return nb;
+      }
+      jobLeft -= nb;
+    }
+    if (jobLeft == 0)
+    {
+      uint32_t ms = millis() - millisBeginJob;
+      reply(250, "Copied %lu bytes in %lu ms", (unsigned long)jobFirst, (unsigned long)ms);
+      endCopy(true);
+    }
+    return nb;
+  }
+
+  if (nb > 0)
+  {
+    nb = jobFile.read((uint8_t *)buf, nb);
+    hasher.update((uint8_t *)buf, nb);
+    jobLeft -= nb;
+    if (nb == 0)
+    {
+      reply(451, "Can't read %s", jobName);
+      jobFile.close();
+      jobStatus = NO_JOB;
+      return 0;
+    }
+  }
+  if (jobLeft == 0)
+  {
+    char hex[FTP_HASH_HEX_SIZE];
+    hasher.finish(hex);
+    if (jobReply == 213)
+    {
+      uint32_t hashed = jobFile.position() - jobFirst;
+      reply(213, "%s %lu-%lu %s %s", FtpHash::name(hasher.algo()), (unsigned long)jobFirst,
+            (unsigned long)(hashed > 0 ? jobFirst + hashed - 1 : jobFirst), hex, jobName);
+    }
+    else
+    {
+      reply(250, "%s", hex);
+    }
+    jobFile.close();
+    jobStatus = NO_JOB;
+    millisEndConnection = millis() + millisTimeOut;
+  }
+  return nb;
+}
+
+// Stop background job, telling client if one was running
+void FtpSession::abortJob()
+{
+  if (jobStatus == HASH_JOB)
+  {
+    jobFile.close();
+    jobStatus = NO_JOB;
+    reply(426, "Digest aborted");
+  }
+  else if (jobStatus == COPY_JOB)
+  {
+    reply(426, "Copy aborted");
+    endCopy(false);
+  }
+  else if (jobStatus == RMDIR_JOB)
+  {
+    jobStatus = NO_JOB;
+    reply(426, "Remove aborted after %lu files and %lu directories", (unsigned long)jobFiles, (unsigned long)jobDirs);
+  }
+}
+
+// Close files of a copy, an incomplete copy is removed
+void FtpSession::endCopy(boolean completed)
+{
+#ifdef ESP8266
+  String path = jobOut.fullName();
+#elif defined ESP32
+  String path = jobOut.path();
+#endif
+  jobFile.close();
+  jobOut.close();
+  if (!completed)
+  {
+    jobOutFs->remove(path);
+  }
+  _server->_dirCache.invalidate(jobOutFs, path.c_str());
+  releasePath(jobFs);
+  releasePath(jobOutFs);
+  jobFs = nullptr;
+  jobOutFs = nullptr;
+  jobStatus = NO_JOB;
+  millisEndConnection = millis() + millisTimeOut;
+}
+
+// File system and path named by a SITE CPFR/CPTO parameter
+//
+//  "SDFS:/dir/file" and "LittleFS:/dir/file" name a file of that file
+//  system, mounted for the session if it isn't its own. Other names are
+//  on the file system of the session
+//
+// return:
+//    file system, nullptr if it can't be used (reply is sent)
+
+FS *FtpSession::mountPath(char *param, char *path)
+{
+  FS *fs = VirtualFS;
+  char *colon = strchr(param, ':');
+  if (colon != NULL && colon[1] == '/')
+  {
+    size_t len = colon - param;
+    if (len == 4 && !strncasecmp(param, "SDFS", 4))
+    {
+      fs = &SDFS;
+      param = colon + 1;
+    }
+    else if (len == 8 && !strncasecmp(param, "LittleFS", 8))
+    {
+      fs = &LittleFS;
+      param = colon + 1;
+    }
+  }
+  if (fs != VirtualFS && _server->mountFileSystem(fs) == nullptr)
+  {
+    reply(450, "SD card is busy, try again later");
+    return nullptr;
+  }
+  if (!makePath(path, param))
+  {
+    releasePath(fs);
+    return nullptr;
+  }
+  return fs;
+}
+
+// Unmount a file system mounted by mountPath()
+void FtpSession::releasePath(FS *fs)
+{
+  if (fs != nullptr && fs != VirtualFS)
+  {
+    _server->unmountFileSystem(fs);
+  }
+}
+
+// SITE CPFR - Name the file to copy
+void FtpSession::siteCopyFrom(char *param)
+{
+  char path[FTP_CWD_SIZE];
+  cpfrCmd = false;
+  if (jobStatus != NO_JOB)
+  {
+    reply(450, "Busy with another job");
+    return;
+  }
+  FS *fs = mountPath(param, path);
+  if (fs == nullptr)
+  {
+    return;
+  }
+  File source = fs->open(path, "r");
+  if (!source || source.isDirectory())
+  {
+    reply(550, "File %s not found", param);
+  }
+  else
+  {
+    strcpy(jobName, param);
+    cpfrCmd = true;
+    reply(350, "File exists, ready for destination");
+  }
+  source.close();
+  releasePath(fs);
+}
+
+// SITE CPTO - Copy file named by SITE CPFR, the copy runs in background
+//
+//  the 250 reply comes when the copy is done, STAT tells how far it is
+
+void FtpSession::siteCopyTo(char *param)
+{
+  char path[FTP_CWD_SIZE];
+  if (!cpfrCmd)
+  {
+    reply(503, "Need SITE CPFR before SITE CPTO");
+    return;
+  }
+  cpfrCmd = false;
+  if (jobStatus != NO_JOB)
+  {
+    reply(450, "Busy with another job");
+    return;
+  }
+  jobOutFs = mountPath(param, path);
+  if (jobOutFs == nullptr)
+  {
+    return;
+  }
+  if (jobOutFs->exists(path))
+  {
+    reply(553, "%s already exists", param);
+    releasePath(jobOutFs);
+    return;
+  }
+  // CPFR name was checked, only mounting or opening it again can fail
+  char source[FTP_CWD_SIZE];
+  jobFs = mountPath(jobName, source);
+  if (jobFs == nullptr)
+  {
+    releasePath(jobOutFs);
+    return;
+  }
+  jobFile = jobFs->open(source, "r");
+  jobOut = jobOutFs->open(path, "w");
+  if (!jobFile || !jobOut)
+  {
+    reply(451, "Can't open %s", !jobFile ? jobName : param);
+    jobFile.close();
+    jobOut.close();
+    releasePath(jobFs);
+    releasePath(jobOutFs);
+    return;
+  }
+  jobFirst = jobFile.size();
+  jobLeft = jobFirst;
+  millisBeginJob = millis();
+  jobStatus = COPY_JOB;
+}
+
+// SITE RMDIR -r - Remove a directory and all it holds, in background
+//
+//  the 250 reply comes when the directory is removed, STAT tells how
+//  far it is
+
+void FtpSession::siteRemoveTree(char *param)
+{
+  if (jobStatus != NO_JOB)
+  {
+    reply(450, "Busy with another job");
+    return;
+  }
+  cpfrCmd = false; // jobName is reused
+  if (!makePath(jobName, param))
+  {
+    return;
+  }
+  if (strcmp(jobName, "/") == 0)
+  {
+    reply(550, "Can't remove root directory");
+  }
+  else if (!isDirectory(jobName))
+  {
+    reply(550, "Directory %s not found", param);
+  }
+  else
+  {
+    jobRootLen = strlen(jobName);
+    jobFiles = 0;
+    jobDirs = 0;
+    millisBeginJob = millis();
+    jobStatus = RMDIR_JOB;
+  }
+}
+
+// Remove next entries of the tree of SITE RMDIR -r
+//
+//  jobName is the directory being emptied: its files are removed, its
+//  first sub-directory becomes the one to empty, and once empty it is
+//  removed and its parent becomes the one to empty. The directory is
+//  read again at each step, so no listing is kept open while removing
+//
+// return:
+//    entries removed, at least 1
+
+uint32_t FtpSession::removeTreeStep()
+{
+  char path[FTP_CWD_SIZE];
+  uint32_t removed = 0;
+  boolean empty = true;
+#ifdef ESP8266
+  Dir dir = VirtualFS->openDir(jobName);
+#elif defined ESP32
+  File dir = VirtualFS->open(jobName);
+#endif
+
+  while (removed < FTP_RMDIR_STEP)
+  {
+    boolean isDir;
+    int len;
+#ifdef ESP8266
+    if (!dir.next())
+      break;
+    isDir = dir.isDirectory();
+    len = snprintf(path, sizeof(path), "%s/%s", jobName, dir.fileName().c_str());
+#elif defined ESP32
+    File entry = dir.openNextFile();
+    if (!entry)
+      break;
+    // Older cores give the full path as name
+    const char *name = entry.name();
+    const char *slash = strrchr(name, '/');
+    isDir = entry.isDirectory();
+    len = snprintf(path, sizeof(path), "%s/%s", jobName, slash != NULL ? slash + 1 : name);
+    entry.close();
+#endif
+    empty = false;
+    if (len < 0 || (size_t)len >= sizeof(path))
+    {
+      reply(451, "Path too long in %s", jobName);
+      jobStatus = NO_JOB;
+      break;
+    }
+    if (isDir)
+    {
+      strcpy(jobName, path);
+      break;
+    }
+    if (!VirtualFS->remove(path))
+    {
+      reply(450, "Can't delete %s", path);
+      jobStatus = NO_JOB;
+      break;
+    }
+    _server->_dirCache.invalidate(VirtualFS, path);
+    jobFiles++;
+    removed++;
+  }
+#ifdef ESP32
+  dir.close();
+#endif
+
+  if (empty)
+  {
+    // LittleFS of ESP8266 removes a directory with its last file
+    if (VirtualFS->exists(jobName) && !VirtualFS->rmdir(jobName))
+    {
+      reply(450, "Can't remove %s", jobName);
+      jobStatus = NO_JOB;
+    }
+    else
+    {
+      _server->_dirCache.invalidate(VirtualFS, jobName);
+      jobDirs++;
+      removed++;
+      if (strlen(jobName) <= jobRootLen)
+      {
+        uint32_t ms = millis() - millisBeginJob;
+        reply(250, "Removed %lu files and %lu directories in %lu ms",
+              (unsigned long)jobFiles, (unsigned long)jobDirs, (unsigned long)ms);
+        jobStatus = NO_JOB;
+      }
+      else
+        *strrchr(jobName, '/') = 0;
+    }
+  }
+  if (jobStatus == NO_JOB)
+  {
+    millisEndConnection = millis() + millisTimeOut;
+  }
+  return removed > 0 ? removed : 1;
+}
+
+// return:
+//    true if path is a directory
+
+boolean FtpSession::isDirectory(const char *path)
+{
+  if (strcmp(path, "/") == 0)
+  {
+    return true;
+  }
+  File file = VirtualFS->open(path, "r");
+  boolean isDir = file && file.isDirectory();
+  file.close();
+  return isDir;
+}
+
+// Size of reads and writes that don't straddle blocks of the file system
+//
+//  a LittleFS block larger than a RETR buffer falls back to its page size
+
+uint16_t FtpSession::fsBlockSize()
+{
+  if (VirtualFS == &SDFS)
+  {
+    return FTP_SD_BLOCK_SIZE;
+  }
+#ifdef ESP8266
+  FSInfo info;
+  if (VirtualFS->info(info))
+  {
+    if (info.blockSize > 0 && info.blockSize <= FTP_RETR_CHUNK)
+    {
+      return info.blockSize;
+    }
+    if (info.pageSize > 0 && info.pageSize <= FTP_RETR_CHUNK)
+    {
+      return info.pageSize;
+    }
+  }
+#endif
+  return 256;
+}
+
+// Read size tuner of file system of session
+FtpChunkTuner &FtpSession::tuner()
+{
+  return _server->_tuner[VirtualFS == &SDFS ? 0 : 1];
+}
+
+// Append decompressed data to first half of buf, writing it when full
+void FtpSession::storeWrite(const uint8_t *data, size_t len)
+{
+  while (len > 0)
+  {
+    size_t nb = FTP_RETR_CHUNK - storeLen;
+    if (nb > len)
+    {
+      nb = len;
+    }
+    memcpy(buf + storeLen, data, nb);
+    storeLen += nb;
+    data += nb;
+    len -= nb;
+    if (storeLen == FTP_RETR_CHUNK)
+    {
+      storeFlush(false);
+    }
+  }
+}
+
+// Write data collected in buf to file
+//
+//  unless all is set, data after the last block boundary is kept in buf
+
+void FtpSession::storeFlush(boolean all)
+{
+  uint16_t nb = storeLen;
+  if (!all)
+  {
+    uint16_t tail = (file.position() + storeLen) % fsBlock;
+    if (tail >= storeLen)
+    {
+      return;
+    }
+    nb -= tail;
+  }
+  if (nb > 0)
+  {
+    uint32_t start = micros();
+    file.write((uint8_t *)buf, nb);
+    fsMicros += micros() - start;
+    storeLen -= nb;
+    memmove(buf, buf + nb, storeLen);
+  }
+}
+
+// Decompress MODE Z upload data in file
+//
+//  output window is moved to the write buffer each time it is full,
+//  until all of in is used
+//
+// return:
+//    false if compressed data is invalid
+
+boolean FtpSession::inflateToFile(const uint8_t *in, size_t len)
+{
+  size_t pos = 0;
+  int8_t rc;
+  size_t drained;
+  do
+  {
+    size_t used;
+    rc = inflater.inflate(in + pos, len - pos, &used);
+    pos += used;
+    drained = 0;
+    const uint8_t *out;
+    size_t nb;
+    while ((nb = inflater.output(&out)) > 0)
+    {
+      storeWrite(out, nb);
+      inflater.consume(nb);
+      drained += nb;
+    }
+  } while (rc == INFLATE_MORE && (pos < len || drained > 0));
+  return rc != INFLATE_ERROR;
+}
+
+// Stored file has a new size, cached listing of its directory is stale
+void FtpSession::invalidateStoredFile()
+{
+  if (transferStatus == STORE_DATA)
+  {
+#ifdef ESP8266
+    _server->_dirCache.invalidate(VirtualFS, file.fullName());
+#elif defined ESP32
+    _server->_dirCache.invalidate(VirtualFS, file.path());
+#endif
+  }
+}
+
+void FtpSession::closeTransfer()
+{
+  if (transferStatus == STORE_DATA)
+  {
+    storeFlush(true);
+  }
+  invalidateStoredFile();
+  uint32_t deltaT = (int32_t)(millis() - millisBeginTrans);
+  boolean completed = true;
+  if (transferStatus == LIST_DATA)
+  {
+    if (dirList.format() == MLSD_FORMAT)
+    {
+      replyPart(226, "options: -a -l");
+    }
+    reply(226, "%u matches total", dirList.count());
+    dirList.end();
+  }
+  else if (modeZ && transferStatus == STORE_DATA && inflater.windowBits() > FTP_INFLATE_WINDOW_BITS)
+  {
+    reply(504, "Compressed data needs a window of %lu bytes, at most %lu supported",
+          1ul << inflater.windowBits(), 1ul << FTP_INFLATE_WINDOW_BITS);
+    completed = false;
+  }
+  else if (modeZ && transferStatus == STORE_DATA && !inflater.finished())
+  {
+    reply(451, "Compressed data is invalid or incomplete");
+    completed = false;
+  }
+  else if (deltaT > 0 && bytesTransfered > 0)
+  {
+    replyPart(226, "File successfully transferred");
+    reply(226, "%lu bytes in %lu ms, %lu KiB/s", (unsigned long)bytesTransfered, (unsigned long)deltaT,
+          (unsigned long)((uint64_t)bytesTransfered * 1000 / deltaT / 1024));
+  }
+  else
+    reply(226, "File successfully transferred");
+  recordTransfer(completed);
+
+#ifdef ESP8266
+  if (transferStatus == STORE_DATA && file.position() < file.size())
+  {
+    // Resumed upload ended before old end of file
+    file.truncate(file.position());
+  }
+#endif
+  if (transferStatus == STORE_DATA && !completed && storeStart == 0)
+  {
+    // What was decompressed of a failed upload is no use to the client
+#ifdef ESP8266
+    String path = file.fullName();
+#elif defined ESP32
+    String path = file.path();
+#endif
+    file.close();
+    VirtualFS->remove(path);
+  }
+  file.close();
+  deflater.end();
+  inflater.end();
+  data.stop();
+}
+
+void FtpSession::abortTransfer()
+{
+  if (transferStatus > NO_TRANSFER)
+  {
+    if (!dataWait)
+    {
+      if (transferStatus == STORE_DATA)
+      {
+        // Keep what was received
+        storeFlush(true);
+      }
+      recordTransfer(false);
+    }
+    invalidateStoredFile();
+    dataWait = false;
+    file.close();
+    dirList.end();
+    deflater.end();
+    inflater.end();
+    data.stop();
+    reply(426, "Transfer aborted");
+#ifdef FTP_DEBUG
+    Serial.println("Transfer aborted!");
+#endif
+  }
+  transferStatus = NO_TRANSFER;
+}
+
+// Give figures of the transfer ending to server stats
+void FtpSession::recordTransfer(boolean completed)
+{
+  FtpTransferStats_t stats;
+  stats.type = transferStatus;
+  stats.completed = completed;
+  stats.bytes = bytesTransfered;
+  stats.durationMs = millis() - millisBeginTrans;
+  stats.netStalls = netStalls;
+  stats.fsMicros = fsMicros;
+  _server->_stats.addTransfer(stats);
+  if (transferStatus == RETRIVE_DATA && !modeZ)
+  {
+    tuner().add(retrRead, bytesTransfered, fsMicros);
+  }
+}
+
+// Send a reply line "code text" to client, text formatted as by printf
+//
+//  the line is formatted on the stack, so replies don't allocate on the
+//  heap, then queued in replyBuf: all replies of a call to handle() go
+//  out in one write, a multi-line reply doesn't wait for an ACK per line
+
+void FtpSession::reply(uint16_t code, const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  replyLine(code, ' ', format, args);
+  va_end(args);
+}
+
+// Send a line "code-text" of a multi-line reply, last line is sent by reply()
+void FtpSession::replyPart(uint16_t code, const char *format, ...)
+{
+  va_list args;
+  va_start(args, format);
+  replyLine(code, '-', format, args);
+  va_end(args);
+}
+
+void FtpSession::replyLine(uint16_t code, char separator, const char *format, va_list args)
+{
+  char line[FTP_REPLY_SIZE];
+  int len = snprintf(line, sizeof(line) - 2, "%03u%c", code, separator);
+  int nb = vsnprintf(line + len, sizeof(line) - 2 - len, format, args);
+  if (nb > 0)
+  {
+    len += nb < (int)sizeof(line) - 2 - len ? nb : sizeof(line) - 3 - len;
+  }
+  line[len++] = '\r';
+  line[len++] = '\n';
+  if (replyLen + len > FTP_REPLY_BUF_SIZE)
+  {
+    flushReplies();
+  }
+  memcpy(replyBuf + replyLen, line, len);
+  replyLen += len;
+}
+
+// Queue a line without reply code, as features listed by FEAT
+void FtpSession::replyText(const char *text)
+{
+  size_t len = strlen(text);
+  if (replyLen + len + 2 > FTP_REPLY_BUF_SIZE)
+  {
+    flushReplies();
+    if (len + 2 > FTP_REPLY_BUF_SIZE)
+    {
+      len = FTP_REPLY_BUF_SIZE - 2;
+    }
+  }
+  memcpy(replyBuf + replyLen, text, len);
+  replyLen += len;
+  replyBuf[replyLen++] = '\r';
+  replyBuf[replyLen++] = '\n';
+}
+
+// Send queued replies
+void FtpSession::flushReplies()
+{
+  if (replyLen > 0)
+  {
+    client.write((const uint8_t *)replyBuf, replyLen);
+    replyLen = 0;
+  }
+}
+
+// Queue in cmdBuf all bytes available from client
+void FtpSession::receiveCommands()
+{
+  int navail = client.available();
+  if (navail > FTP_RX_SIZE - iCB)
+  {
+    navail = FTP_RX_SIZE - iCB;
+  }
+  if (navail > 0)
+  {
+    int16_t nb = client.read((uint8_t *)cmdBuf + iCB, navail);
+    if (nb > 0)
+    {
+      iCB += nb;
+    }
+  }
+}
+
+// Skip Telnet commands at the start of a command line, as the IAC IP
+//   IAC DM (interrupt process, data mark) RFC 959 clients send before ABOR
+//
+// return:
+//    first char of the command
+
+static char *skipTelnet(char *p, const char *eol)
+{
+  while (p + 1 < eol && (uint8_t)*p == 0xFF) // IAC and the command following it
+  {
+    p += 2;
+  }
+  return p;
+}
+
+// Check if the next command may be processed now
+//
+//  while a transfer runs or waits for its data connection, or a job of
+//  HASH, SITE CPTO or SITE RMDIR -r runs, pipelined commands stay queued
+//  in cmdBuf, so they can't change its data connection or reply before
+//  it. ABOR, STAT and QUIT go ahead of them, moved to the front of the
+//  queue
+//
+// return:
+//    true if readCommand() may be called
+
+boolean FtpSession::commandReady()
+{
+  if (transferStatus == NO_TRANSFER && jobStatus == NO_JOB)
+  {
+    return true;
+  }
+  receiveCommands();
+  if (cmdSkip || memchr(cmdBuf, '\n', iCB) == NULL)
+  {
+    // readCommand() drops a line too long for cmdBuf
+    return iCB >= FTP_RX_SIZE;
+  }
+  char *line = cmdBuf;
+  char *eol;
+  while ((eol = (char *)memchr(line, '\n', cmdBuf + iCB - line)) != NULL)
+  {
+    uint64_t verb = 0;
+    char *start = skipTelnet(line, eol);
+    for (char *p = start; p < eol && p < start + FTP_VERB_SIZE && isalnum(*p); p++)
+    {
+      verb = (verb << 8) | (uint8_t)toupper(*p);
+    }
+    size_t len = eol + 1 - line;
+    if ((verb == ftpVerb("ABOR") || verb == ftpVerb("STAT") || verb == ftpVerb("QUIT")) && len <= sizeof(cmdLine))
+    {
+      if (line > cmdBuf)
+      {
+        // cmdLine is free until readCommand() fills it
+        memcpy(cmdLine, line, len);
+        memmove(cmdBuf + len, cmdBuf, line - cmdBuf);
+        memcpy(cmdBuf, cmdLine, len);
+      }
+      return true;
+    }
+    line = eol + 1;
+  }
+  return false;
+}
+
+// Read command lines from client connected to ftp server
+//
+//  all bytes available are read at once in cmdBuf, then first complete
+//  line is moved to cmdLine. Next lines sent in the same segment stay
+//  queued in cmdBuf for next calls
+//
+//  update cmdLine and command buffers, iCL, iCB and parameters pointers
+//
+//  return:
+//    -2 if line is too long or syntax error
+//    -1 if line not completed
+//     0 if empty line received
+//    length of cmdLine (positive) if no empty line received
+
+int16_t FtpSession::readCommand()
+{
+  int16_t rc = -1;
+
+  receiveCommands();
+  char *eol = (char *)memchr(cmdBuf, '\n', iCB);
+  if (eol == NULL)
+  {
+    if (iCB < FTP_RX_SIZE)
+    {
+      return -1;
+    }
+    // No end of line in full buffer, drop the rest of the line too
+    iCB = 0;
+    if (!cmdSkip)
+    {
+      cmdSkip = true;
+      reply(500, "Syntax error");
+    }
+    return -2;
+  }
+  if (cmdSkip)
+  {
+    iCB -= eol + 1 - cmdBuf;
+    memmove(cmdBuf, eol + 1, iCB);
+    cmdSkip = false;
+    return -2;
+  }
+
+  iCL = 0;
+  for (char *p = skipTelnet(cmdBuf, eol); p < eol; p++)
+  {
+    char c = *p;
+    if (c == '\\')
+    {
+      c = '/';
+    }
+    if (c != '\r')
+    {
+      if (iCL < FTP_CMD_SIZE - 1)
+        cmdLine[iCL++] = c;
+      else
+        rc = -2; //  Line too long
+    }
+  }
+  cmdLine[iCL] = 0;
+
+  // Remove line from queue
+  iCB -= eol + 1 - cmdBuf;
+  memmove(cmdBuf, eol + 1, iCB);
+
+#ifdef FTP_DEBUG
+  Serial.println(cmdLine);
+#endif
+
+  command[0] = 0;
+  parameters = cmdLine + iCL; // no parameters: empty string
+  if (rc == -2)
+    ;
+  // empty line?
+  else if (iCL == 0)
+    rc = 0;
+  else
+  {
+    rc = iCL;
+    // search for space between command and parameters
+    char *space = strchr(cmdLine, ' ');
+    if (space != NULL)
+    {
+      parameters = space;
+      if (parameters - cmdLine > FTP_VERB_SIZE)
+        rc = -2; // Syntax error
+      else
+      {
+        strncpy(command, cmdLine, parameters - cmdLine);
+        command[parameters - cmdLine] = 0;
+
+        while (*(++parameters) == ' ')
+          ;
+      }
+    }
+    else if (strlen(cmdLine) > FTP_VERB_SIZE)
+      rc = -2; // Syntax error.
+    else
+      strcpy(command, cmdLine);
+  }
+  if (rc > 0)
+    for (uint8_t i = 0; i < strlen(command); i++)
+      command[i] = toupper(command[i]);
+  if (rc == -2)
+  {
+    reply(500, "Syntax error");
+  }
+  return rc;
+}
+
+// Size and usage of file system of session
+//
+// return:
+//    false if file system doesn't report them
+
+boolean FtpSession::spaceInfo(uint64_t *total, uint64_t *used)
+{
+#ifdef ESP8266
+  FSInfo64 info;
+  if (VirtualFS->info64(info))
+  {
+    *total = info.totalBytes;
+    *used = info.usedBytes;
+    return true;
+  }
+#endif
+  return false;
+}
+
+// Make complete path/name from cwdName and parameters
+//
+// 3 possible cases: parameters can be absolute path, relative path or only the name
+//
+// parameters:
+//   fullName : where to store the path/name
+//
+// return:
+//    true, if done
+
+boolean FtpSession::makePath(char *fullName)
+{
+  return makePath(fullName, parameters);
+}
+
+// Remove ".", ".." and empty parts of path, including a trailing '/'
+static void removeDots(char *path)
+{
+  char *out = path;
+  const char *in = path;
+  while (*in != 0)
+  {
+    while (*in == '/')
+      in++;
+    if (*in == 0)
+      break;
+    const char *end = strchr(in, '/');
+    if (end == NULL)
+      end = in + strlen(in);
+    size_t n = end - in;
+    if (n == 2 && in[0] == '.' && in[1] == '.')
+    {
+      // Back to parent, not above root
+      while (out > path && *--out != '/')
+        ;
+    }
+    else if (n != 1 || in[0] != '.')
+    {
+      *out++ = '/';
+      memmove(out, in, n);
+      out += n;
+    }
+    in = end;
+  }
+  if (out == path)
+    *out++ = '/';
+  *out = 0;
+}
+
+boolean FtpSession::makePath(char *fullName, char *param)
 {
   if (param == NULL)
     param = parameters;
@@ -1193,24 +3034,39 @@ boolean FtpServer::makePath(char *fullName, char *param)
     return true;
   }
   // If relative path, concatenate with current dir
+  size_t len = strlen(param);
   if (param[0] != '/')
   {
-    strcpy(fullName, cwdName);
-    if (fullName[strlen(fullName) - 1] != '/')
-      strncat(fullName, "/", FTP_CWD_SIZE);
-    strncat(fullName, param, FTP_CWD_SIZE);
+    size_t cwdLen = strlen(cwdName);
+    boolean slash = cwdLen == 0 || cwdName[cwdLen - 1] != '/';
+    if (cwdLen + slash + len >= FTP_CWD_SIZE)
+    {
+      reply(500, "Command line too long");
+      return false;
+    }
+    memcpy(fullName, cwdName, cwdLen);
+    if (slash)
+      fullName[cwdLen++] = '/';
+    memcpy(fullName + cwdLen, param, len + 1);
   }
+  else if (len < FTP_CWD_SIZE)
+    memcpy(fullName, param, len + 1);
   else
-    strcpy(fullName, param);
-  // If ends with '/', remove it
-  uint16_t strl = strlen(fullName) - 1;
-  if (fullName[strl] == '/' && strl > 1)
-    fullName[strl] = 0;
-  if (strlen(fullName) < FTP_CWD_SIZE)
-    return true;
+  {
+    reply(500, "Command line too long");
+    return false;
+  }
+  removeDots(fullName);
+  return true;
+}
 
-  client.println("500 Command line too long");
-  return false;
+// Value of n decimal digits, already checked
+static uint16_t digits(const char *s, uint8_t n)
+{
+  uint16_t v = 0;
+  while (n-- > 0)
+    v = v * 10 + *s++ - '0';
+  return v;
 }
 
 // Calculate year, month, day, hour, minute and second
@@ -1224,11 +3080,9 @@ boolean FtpServer::makePath(char *fullName, char *param)
 //    0 if parameter is not YYYYMMDDHHMMSS
 //    length of parameter + space
 
-uint8_t FtpServer::getDateTime(uint16_t *pyear, uint8_t *pmonth, uint8_t *pday,
+uint8_t FtpSession::getDateTime(uint16_t *pyear, uint8_t *pmonth, uint8_t *pday,
                                uint8_t *phour, uint8_t *pminute, uint8_t *psecond)
 {
-  char dt[15];
-
   // Date/time are expressed as a 14 digits long string
   //   terminated by a space and followed by name of file
   if (strlen(parameters) < 15 || parameters[14] != ' ')
@@ -1237,19 +3091,21 @@ uint8_t FtpServer::getDateTime(uint16_t *pyear, uint8_t *pmonth, uint8_t *pday,
     if (!isdigit(parameters[i]))
       return 0;
 
-  strncpy(dt, parameters, 14);
-  dt[14] = 0;
-  *psecond = atoi(dt + 12);
-  dt[12] = 0;
-  *pminute = atoi(dt + 10);
-  dt[10] = 0;
-  *phour = atoi(dt + 8);
-  dt[8] = 0;
-  *pday = atoi(dt + 6);
-  dt[6] = 0;
-  *pmonth = atoi(dt + 4);
-  dt[4] = 0;
-  *pyear = atoi(dt);
+  uint16_t year = digits(parameters, 4);
+  uint8_t month = digits(parameters + 4, 2);
+  uint8_t day = digits(parameters + 6, 2);
+  uint8_t hour = digits(parameters + 8, 2);
+  uint8_t minute = digits(parameters + 10, 2);
+  uint8_t second = digits(parameters + 12, 2);
+  if (month < 1 || month > 12 || day < 1 || day > 31 ||
+      hour > 23 || minute > 59 || second > 60)
+    return 0;
+  *pyear = year;
+  *pmonth = month;
+  *pday = day;
+  *phour = hour;
+  *pminute = minute;
+  *psecond = second;
   return 15;
 }
 
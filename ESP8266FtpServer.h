@@ -37,6 +37,12 @@
 #include <LittleFS.h>
 #include <SDFS.h>
 #include <time.h>
+#include <stdarg.h>
+#include "ftpDirList.h"
+#include "ftpDeflate.h"
+#include "ftpStats.h"
+#include "ftpTuner.h"
+#include "ftpHash.h"
 
 /* Configuration of NTP */
 #define MY_NTP_SERVER "bg.pool.ntp.org"
@@ -45,16 +51,34 @@
 #define FTP_SERVER_VERSION "FTP-2017-10-18"
 
 #define FTP_CTRL_PORT 21         // Command port on wich server is listening
-#define FTP_DATA_PORT_PASV 50009 // Data port in passive mode
+#define FTP_DATA_PORT_PASV 50009 // First data port in passive mode
+#define FTP_PASV_PORTS 4u        // passive data ports, handed out in turn from FTP_DATA_PORT_PASV
 
 #define FTP_TIME_OUT 5       // Disconnect client after 5 minutes of inactivity
+#define FTP_DATA_TIME_OUT 10 // Wait 10 seconds for a data connection
+#define FTP_FS_TIME_OUT 30     // Wait 30 seconds for the SD bus at login
+#define FTP_RMDIR_STEP 16      // Max entries removed by SITE RMDIR -r between two reads of directory
 #define FTP_CMD_SIZE 255 + 8 // max size of a command
+#define FTP_VERB_SIZE 7      // max length of a command verb, as XSHA256
+#define FTP_RX_SIZE 512      // size of buffer for incoming command lines
+#define FTP_REPLY_SIZE 320   // max size of a reply line, longer ones are cut
+#define FTP_REPLY_BUF_SIZE 512 // replies of a command are collected and sent at once
+#define FTP_CTRL_NODELAY 1     // 1 to disable Nagle on control connection, replies are already batched
 #define FTP_CWD_SIZE 255 + 8 // max size of a directory name
 #define FTP_FIL_SIZE 255     // max size of a file name
 // #define FTP_BUF_SIZE 1024 //512   // size of file buffer for read/write
-#define FTP_BUF_SIZE 2 * 1460 // 512   // size of file buffer for read/write
+#define FTP_BUF_SIZE 2 * FTP_TCP_MSS // 512   // size of file buffer for read/write
+#define FTP_RETR_BUFFERS 2    // number of read ahead buffers buf is split in for RETR
+#define FTP_RETR_CHUNK ((FTP_BUF_SIZE) / FTP_RETR_BUFFERS)
+#define FTP_SD_BLOCK_SIZE 512 // SD sector size, uploads are written by multiple of it
+
+#define FTP_NO_RANGE 0xFFFFFFFFu // no end of range set by RANG
 
 #define FTP_USER_COUNT 3u
+#define FTP_MAX_SESSIONS 2u // max number of concurrent ftp sessions
+
+#define FTP_HANDLE_BUDGET_US 5000     // handleFTP() keeps moving data for at most this time, 0 for one pass
+#define FTP_HANDLE_BUDGET_BYTES 16384 // and at most this many bytes on data connections
 
 typedef enum
 {
@@ -63,6 +87,34 @@ typedef enum
   SD_MODE_COUNТ
 } SDMode_t;
 
+typedef enum
+{
+  DISCONNECTED = 0,
+  WAIT_FOR_CONNECTION = 1,
+  IDLE = 2,
+  WAIT_FOR_USER_IDENTITY = 3,
+  WAIT_FOR_USER_PASSWORD = 4,
+  WAIT_FOR_FILE_SYSTEM = 5,
+  WAIT_FOR_USER_COMMAND = 6,
+  COMMAND_STATUS_COUNT
+} CommandStatus_t;
+
+typedef enum
+{
+  NO_TRANSFER = 0,
+  RETRIVE_DATA = 1,
+  STORE_DATA = 2,
+  LIST_DATA = 3
+} TransferStatus_t;
+
+typedef enum
+{
+  NO_JOB = 0,
+  HASH_JOB = 1, // digest of a file for HASH or XCRC/XMD5/XSHA*
+  COPY_JOB = 2, // copy of a file for SITE CPTO
+  RMDIR_JOB = 3 // removal of a tree for SITE RMDIR -r
+} JobStatus_t;
+
 typedef struct
 {
   String name;
@@ -70,89 +122,245 @@ typedef struct
   int16_t pin;
 } User_t;
 
-class FtpServer
+class FtpServer;
+class FtpSession;
+
+// Listener of a passive data port, lent to one session at a time
+typedef struct PasvPort
+{
+  PasvPort() : server(FTP_DATA_PORT_PASV) {}
+  WiFiServer server;
+  uint16_t port;
+  FtpSession *owner; // session the port is lent to, or nullptr
+} PasvPort_t;
+
+// State of one control connection, with its own data connection,
+// working directory and file in transfer
+class FtpSession
 {
 public:
-  FtpServer()
-  {
-    _userIndex = 0u;
-  }
-  void addUser(String uname, String pword, int16_t pin = NOT_A_PIN);
-  void begin();
-  void handleFTP();
+  FtpSession() {}
+  void begin(FtpServer *server);
+  boolean isFree();
+  void attach(WiFiClient &newClient);
+  uint32_t handle();
 
 private:
   void iniVariables();
+  void reply(uint16_t code, const char *format, ...) __attribute__((format(printf, 3, 4)));
+  void replyPart(uint16_t code, const char *format, ...) __attribute__((format(printf, 3, 4)));
+  void replyLine(uint16_t code, char separator, const char *format, va_list args);
+  void replyText(const char *text);
+  void flushReplies();
   void clientConnected();
+  boolean startHash(uint8_t algo, uint16_t code);
+  uint32_t doJob();
+  void abortJob();
+  void endCopy(boolean completed);
+  FS *mountPath(char *param, char *path);
+  void releasePath(FS *fs);
+  void siteCopyFrom(char *param);
+  void siteCopyTo(char *param);
+  void siteRemoveTree(char *param);
+  uint32_t removeTreeStep();
+  boolean isDirectory(const char *path);
+  void waitFileSystem();
   void disconnectClient();
-  boolean userIdentity();
-  boolean userPassword();
+  void releaseFileSystem();
+  boolean takePasvPort();
+  void releasePasvPort();
   boolean processCommand();
+  void openDataConnection(int8_t transfer);
   boolean dataConnect();
+  boolean waitDataConnection();
+  boolean doList();
+  size_t dataWriteRoom();
+  boolean beginModeZ();
+  size_t deflateChunk(uint8_t *out, size_t size);
+  boolean inflateToFile(const uint8_t *in, size_t len);
+  uint16_t fsBlockSize();
+  FtpChunkTuner &tuner();
+  void storeWrite(const uint8_t *data, size_t len);
+  void storeFlush(boolean all);
   boolean doRetrieve();
   boolean doStore();
+  void invalidateStoredFile();
   void closeTransfer();
   void abortTransfer();
+  void recordTransfer(boolean completed);
+  boolean spaceInfo(uint64_t *total, uint64_t *used);
   boolean makePath(char *fullname);
   boolean makePath(char *fullName, char *param);
   uint8_t getDateTime(uint16_t *pyear, uint8_t *pmonth, uint8_t *pday,
                       uint8_t *phour, uint8_t *pminute, uint8_t *second);
-  int8_t readChar();
+  int16_t readCommand();
+  void receiveCommands();
+  boolean commandReady();
+  FtpServer *_server = nullptr;
   FS *VirtualFS = nullptr;
   IPAddress dataIp; // IP address of client for data
   WiFiClient client;
   WiFiClient data;
+  PasvPort_t *pasv = nullptr; // passive data port lent by server
 
   File file;
+  FtpDirList dirList; // directory listing in progress
+  FtpDeflate deflater; // compressor of MODE Z downloads
+  FtpInflate inflater; // decompressor of MODE Z uploads
+  FtpHash hasher;      // digest computed by HASH job
+  File jobFile;        // file read by job
+  File jobOut;         // file written by COPY_JOB
+  FS *jobFs = nullptr;    // file system of jobFile
+  FS *jobOutFs = nullptr; // file system of jobOut
 
   boolean dataPassiveConn;
+  boolean epsvAll;            // EPSV ALL received, PASV and PORT are refused
   uint16_t dataPort;
   char buf[FTP_BUF_SIZE];     // data buffer for transfers
-  char cmdLine[FTP_CMD_SIZE]; // where to store incoming char from client
+  char replyBuf[FTP_REPLY_BUF_SIZE]; // replies not sent yet
+  uint16_t replyLen = 0;      // bytes in replyBuf
+  char cmdBuf[FTP_RX_SIZE];   // where to store incoming chars from client
+  char cmdLine[FTP_CMD_SIZE]; // command line being processed
   char cwdName[FTP_CWD_SIZE]; // name of current directory
-  char command[5];            // command sent by client
+  char command[FTP_VERB_SIZE + 1]; // command sent by client
+  char jobName[FTP_CWD_SIZE]; // name given to command that started job, or to SITE CPFR,
+                              //   or directory being emptied by RMDIR_JOB
   boolean rnfrCmd;            // previous command was RNFR
+  char rnfrName[FTP_CWD_SIZE]; // file named by RNFR
+  boolean cpfrCmd;            // SITE CPFR named the file to copy in jobName
+  boolean modeZ;              // transfers are compressed (MODE Z)
+  uint32_t restartOffset;     // offset set by REST or RANG for next transfer
+  uint32_t rangeEnd;          // last byte to send set by RANG
+  uint32_t allocSize;         // bytes announced by ALLO for next STOR
+  uint32_t retrLeft;          // bytes of file still to read for RETR
+  uint32_t jobFirst;          // first byte of file hashed, or bytes to copy
+  uint32_t jobLeft;           // bytes of file still to read for job
+  uint16_t jobReply;          // reply code of job result
+  uint16_t jobRootLen;        // length of path of tree removed by RMDIR_JOB
+  uint32_t jobFiles,          // files removed by RMDIR_JOB
+      jobDirs;                // directories removed by RMDIR_JOB
+  uint8_t hashAlgo;           // algorithm of HASH, set by OPTS HASH
+  boolean dataWait;           // transfer is waiting for data connection
+  boolean cmdSkip;            // drop incoming chars up to end of line
   char *parameters;           // point to begin of parameters sent by client
-  uint16_t iCL;               // pointer to cmdLine next incoming char
+  uint16_t iCL;               // length of cmdLine
+  uint16_t iCB;               // pointer to cmdBuf next incoming char
+  uint16_t retrLen[FTP_RETR_BUFFERS]; // bytes read in each RETR buffer
+  uint16_t storeLen;          // bytes of buf not written to file yet for STOR
+  uint32_t storeStart;        // offset STOR writes from, a failed MODE Z upload from 0 is removed
+  uint16_t fsBlock;           // block of file system, reads and writes end on its boundaries
+  uint16_t retrRead;          // bytes read from file at once for RETR
+  uint16_t retrPos;           // bytes already sent from retrHead buffer
+  uint8_t retrHead,           // next RETR buffer to send
+      retrCount;              // RETR buffers waiting to be sent
+  boolean retrEof;            // all of file is read
   int8_t cmdStatus,           // status of ftp command connexion
-      transferStatus;         // status of ftp data transfer
+      transferStatus,         // status of ftp data transfer
+      jobStatus;              // background work of a command, see JobStatus_t
   uint32_t millisTimeOut,     // disconnect after 5 min of inactivity
       millisDelay,
       millisEndConnection, //
+      millisEndData,       // give up waiting for data connection
       millisBeginTrans,    // store time of beginning of a transaction
-      bytesTransfered;     //
+      millisBeginJob,      // start of background job
+      bytesTransfered,     //
+      netStalls,           // calls of transfer with TCP not ready, see FtpTransferStats_t
+      fsMicros;            // time of transfer spent in file system
 
-  User_t _user[FTP_USER_COUNT];
-  uint8_t _userIndex = 0u;
   int8_t _selectedUser = -1;
-  int16_t _sdCSPin = 5;
 
+  typedef bool (FtpSession::*CommandHandler)();
+  typedef struct
+  {
+    CommandHandler handler;
+    uint8_t states; // bit mask of cmdStatus values command is accepted in
+  } Command_t;
+  static Command_t findCommand(uint64_t verb);
+
+  bool command_USER();
+  bool command_PASS();
   bool command_CDUP();
   bool command_CWD();
   bool command_PWD();
   bool command_QUIT();
   bool command_MODE();
   bool command_PASV();
+  bool command_EPSV();
   bool command_PORT();
   bool command_STRU();
   bool command_TYPE();
   bool command_ABOR();
+  bool command_ALLO();
   bool command_DELE();
   bool command_LIST();
   bool command_MLSD();
   bool command_NLST();
   bool command_NOOP();
+  bool command_STAT();
   bool command_RETR();
   bool command_STOR();
+  bool command_REST();
   bool command_MKD();
   bool command_RMD();
   bool command_RNFR();
   bool command_RNTO();
+  bool command_AVBL();
+  bool command_HASH();
+  bool command_XCRC();
+  bool command_XMD5();
+  bool command_XSHA1();
+  bool command_XSHA256();
+  bool command_OPTS();
   bool command_FEAT();
+  bool command_RANG();
   bool command_MDTM();
+  bool command_MFMT();
+  bool command_MLST();
   bool command_SIZE();
   bool command_SITE();
   bool command_Unrecognized();
 };
 
+class FtpServer
+{
+public:
+  FtpServer()
+  {
+    _userIndex = 0u;
+  }
+  void addUser(String uname, String pword, int16_t pin = NOT_A_PIN);
+  void begin();
+  void handleFTP();
+  void setStatsCallback(FtpStatsCallback callback) { _stats.callback = callback; }
+  FtpStats &stats() { return _stats; }
+  void invalidateDirCache() { _dirCache.clear(); }
+  void setHandleBudget(uint32_t micros, uint32_t bytes)
+  {
+    _budgetMicros = micros;
+    _budgetBytes = bytes;
+  }
+
+private:
+  friend class FtpSession;
+
+  FS *mountFileSystem(int8_t user);
+  FS *mountFileSystem(FS *fs);
+  void unmountFileSystem(FS *fs);
+
+  FtpSession _session[FTP_MAX_SESSIONS];
+  PasvPort_t _pasvPort[FTP_PASV_PORTS];
+  uint8_t _nextPasv = 0u; // next passive port to lend
+  FtpDirCache _dirCache; // listings of last directories, shared by sessions
+  FtpStats _stats;
+  FtpChunkTuner _tuner[2]; // RETR read size of SDFS and LittleFS
+  uint32_t _budgetMicros = FTP_HANDLE_BUDGET_US;  // see setHandleBudget()
+  uint32_t _budgetBytes = FTP_HANDLE_BUDGET_BYTES;
+
+  User_t _user[FTP_USER_COUNT];
+  uint8_t _userIndex = 0u;
+  uint8_t _sdfsSessions = 0u;     // sessions using SDFS
+  uint8_t _littlefsSessions = 0u; // sessions using LittleFS
+  int16_t _sdCSPin = 5;
+};
+
 #endif // FTP_SERVERESP_H
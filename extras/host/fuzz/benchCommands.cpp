@@ -0,0 +1,50 @@
+// Benchmark of the control path: ns per command line, from reading it
+//   to queuing its reply, for a few kinds of lines
+//
+//  lines are pipelined by batches, as a client does, so the time is the
+//  one of parsing and dispatch more than of socket calls
+#include "hostSession.h"
+
+static const struct
+{
+  const char *name;
+  const char *line;
+} benches[] = {
+    {"NOOP", "NOOP\r\n"},
+    {"TYPE", "TYPE I\r\n"},
+    {"PWD", "PWD\r\n"},
+    {"CWD relative", "CWD ./a/../b/./../\r\n"},
+    {"SIZE long path", "SIZE /logs/2024/02/29/sensor-0001/readings-235958.csv\r\n"},
+    {"MDTM with date", "MDTM 20240229235958 /no/such/file.csv\r\n"},
+    {"PORT", "PORT 127,0,0,1,195,80\r\n"},
+    {"unknown verb", "XYZZY some parameters\r\n"},
+};
+
+#define BENCH_LINES 20000
+#define BENCH_BATCH 8
+
+int main()
+{
+  static HostSession host;
+  host.begin();
+  host.connect();
+  static const char login[] = "USER littlefs\r\nPASS password\r\n";
+  host.send(login, strlen(login));
+  host.run(20);
+
+  for (const auto &bench : benches)
+  {
+    std::string batch;
+    for (int i = 0; i < BENCH_BATCH; i++)
+      batch += bench.line;
+    unsigned long start = micros();
+    for (int i = 0; i < BENCH_LINES / BENCH_BATCH; i++)
+    {
+      host.send(batch.data(), batch.size());
+      host.run(1);
+    }
+    unsigned long us = micros() - start;
+    printf("%-16s %8.0f ns per line\n", bench.name, us * 1000.0 / BENCH_LINES);
+  }
+  return 0;
+}
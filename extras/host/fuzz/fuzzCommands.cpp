@@ -0,0 +1,33 @@
+// Fuzz target: command lines of a control connection
+//
+//  the first byte picks the login: none, as "littlefs" or as "sdfs". The
+//  rest goes to the session as sent by a client, so readCommand(),
+//  command dispatch, makePath(), getDateTime() and the PORT parser see
+//  it. Out of bounds accesses are reported by the sanitizers
+#include "hostSession.h"
+
+static HostSession host;
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+  static bool started = false;
+  if (!started)
+  {
+    host.begin();
+    started = true;
+  }
+  host.connect();
+  if (size > 0)
+  {
+    static const char *const logins[] = {
+        "",
+        "USER littlefs\r\nPASS password\r\n",
+        "USER sdfs\r\nPASS password\r\n"};
+    const char *login = logins[data[0] % 3];
+    host.send(login, strlen(login));
+    host.send(data + 1, size - 1);
+  }
+  host.endInput();
+  host.run(200);
+  return 0;
+}
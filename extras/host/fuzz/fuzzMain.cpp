@@ -0,0 +1,112 @@
+// Driver of the fuzz target for compilers without libFuzzer
+//
+//    ftpfuzz [-runs=N] [file or directory ...]
+//
+//  replays the given inputs, or runs N inputs made of random command
+//  lines: known verbs with random parameters, paths and dates
+#include <dirent.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+static const char *const verbs[] = {
+    "USER", "PASS", "CWD", "CDUP", "PWD", "QUIT", "MODE", "PASV", "EPSV", "PORT",
+    "STRU", "TYPE", "ABOR", "ALLO", "DELE", "LIST", "MLSD", "NLST", "NOOP",
+    "RETR", "STOR", "REST", "MKD", "RMD", "RNFR", "RNTO", "AVBL", "HASH", "XCRC",
+    "XMD5", "XSHA1", "XSHA256", "OPTS", "FEAT", "RANG", "MDTM", "MFMT", "MLST",
+    "SIZE", "SITE", "STAT", "XSHA2567"};
+static const char *const pieces[] = {
+    "/", "..", ".", "a", "dir/", "//", "\\", " ", "-r ", "CPFR ", "CPTO ", "RMDIR ",
+    "SDFS:", "LittleFS:", "HASH ", "SHA-256", "20240229235958 ", "99999999999999",
+    "127,0,0,1,", "255,", "-1,", "4294967296", "ALL", "2", "Z", "I", "\r\n", "\n"};
+
+static void runFile(const char *path)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr)
+  {
+    perror(path);
+    exit(1);
+  }
+  std::vector<uint8_t> data;
+  int c;
+  while ((c = fgetc(f)) != EOF)
+    data.push_back(c);
+  fclose(f);
+  LLVMFuzzerTestOneInput(data.data(), data.size());
+}
+
+static void runPath(const char *path)
+{
+  struct stat st;
+  if (stat(path, &st) == 0 && S_ISDIR(st.st_mode))
+  {
+    DIR *d = opendir(path);
+    struct dirent *e;
+    while ((e = readdir(d)) != nullptr)
+      if (e->d_name[0] != '.')
+        runPath((std::string(path) + "/" + e->d_name).c_str());
+    closedir(d);
+  }
+  else
+    runFile(path);
+}
+
+// Random command lines, long ones included
+static std::string randomInput()
+{
+  std::string s(1, (char)(rand() % 3));
+  int lines = 1 + rand() % 12;
+  for (int i = 0; i < lines; i++)
+  {
+    s += verbs[rand() % (sizeof(verbs) / sizeof(verbs[0]))];
+    s += ' ';
+    int n = rand() % 8;
+    for (int j = 0; j < n; j++)
+    {
+      if (rand() % 4 == 0)
+        s += std::string(rand() % 300, 'x');
+      else if (rand() % 4 == 0)
+        s += (char)(rand() % 256);
+      else
+        s += pieces[rand() % (sizeof(pieces) / sizeof(pieces[0]))];
+    }
+    s += "\r\n";
+  }
+  return s;
+}
+
+int main(int argc, char **argv)
+{
+  long runs = 10000;
+  int files = 0;
+  for (int i = 1; i < argc; i++)
+  {
+    if (strncmp(argv[i], "-runs=", 6) == 0)
+      runs = atol(argv[i] + 6);
+    else
+    {
+      runPath(argv[i]);
+      files++;
+    }
+  }
+  if (files > 0)
+  {
+    printf("%d inputs replayed\n", files);
+    return 0;
+  }
+  srand(1);
+  for (long i = 0; i < runs; i++)
+  {
+    std::string s = randomInput();
+    LLVMFuzzerTestOneInput((const uint8_t *)s.data(), s.size());
+  }
+  printf("%ld random inputs run\n", runs);
+  return 0;
+}
@@ -0,0 +1,113 @@
+// Host backend: one FtpSession driven through a socket pair
+#include "hostSession.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// Users of ftpd, on a scratch directory unless the roots are given
+void HostSession::begin()
+{
+  hostQuiet = true;
+  if (getenv("FTP_LITTLEFS_ROOT") == nullptr || getenv("FTP_SDFS_ROOT") == nullptr)
+  {
+    static char root[] = "/tmp/ftpfuzz.XXXXXX";
+    if (mkdtemp(root) == nullptr)
+    {
+      perror("mkdtemp");
+      exit(1);
+    }
+    setenv("FTP_LITTLEFS_ROOT", root, 1);
+    setenv("FTP_SDFS_ROOT", root, 1);
+  }
+  _server.addUser("sdfs", "password", 5);
+  _server.addUser("littlefs", "password", NOT_A_PIN);
+  _session.begin(&_server);
+}
+
+// New control connection, the session drops what the previous one left
+void HostSession::connect()
+{
+  int fd[2];
+  if (_peer >= 0)
+  {
+    close(_peer);
+  }
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0)
+  {
+    perror("socketpair");
+    exit(1);
+  }
+  fcntl(fd[0], F_SETFL, O_NONBLOCK);
+  fcntl(fd[1], F_SETFL, O_NONBLOCK);
+  _peer = fd[1];
+  WiFiClient client(fd[0]);
+  _session.attach(client);
+}
+
+// Send bytes from the client, replies are read meanwhile so the session
+//   never waits on a full socket. Bytes sent after the session closed
+//   the connection are dropped
+void HostSession::send(const void *data, size_t size)
+{
+  const uint8_t *p = (const uint8_t *)data;
+  while (size > 0)
+  {
+    ssize_t n = ::send(_peer, p, size, MSG_NOSIGNAL);
+    if (n > 0)
+    {
+      p += n;
+      size -= n;
+    }
+    else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+      // The session closed the connection, the rest is not read
+      return;
+    }
+    else
+    {
+      _session.handle();
+      drain();
+    }
+  }
+}
+
+// Client closes its side, the session sees the disconnection once all
+//   is read
+void HostSession::endInput()
+{
+  shutdown(_peer, SHUT_WR);
+}
+
+// Run the session until it is free or after maxCalls calls of handle()
+//
+// return:
+//    bytes of replies
+
+size_t HostSession::run(uint16_t maxCalls)
+{
+  size_t bytes = 0;
+  for (uint16_t i = 0; i < maxCalls && !_session.isFree(); i++)
+  {
+    _session.handle();
+    bytes += drain();
+  }
+  return bytes + drain();
+}
+
+// Read replies sent to the client
+//
+// return:
+//    bytes read
+
+size_t HostSession::drain()
+{
+  char buf[4096];
+  size_t bytes = 0;
+  ssize_t n;
+  while ((n = read(_peer, buf, sizeof(buf))) > 0)
+  {
+    bytes += n;
+  }
+  return bytes;
+}
@@ -0,0 +1,26 @@
+// Host backend: one FtpSession driven through a socket pair, for the
+//   fuzzer and the benchmark
+//
+//  the session runs without listening sockets: PASV waits for a data
+//  connection that never comes, until the next input replaces it
+#ifndef HOST_SESSION_H
+#define HOST_SESSION_H
+#include "ESP8266FtpServer.h"
+
+class HostSession
+{
+public:
+  void begin();
+  void connect();
+  void send(const void *data, size_t size);
+  void endInput();
+  size_t run(uint16_t maxCalls);
+  size_t drain();
+
+private:
+  FtpServer _server;
+  FtpSession _session;
+  int _peer = -1; // client end of the control connection
+};
+
+#endif
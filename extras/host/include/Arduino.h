@@ -0,0 +1,112 @@
+// Host backend: the part of the Arduino core the FTP server uses,
+//   so the same sources build and run on Linux
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <time.h>
+#include <string>
+#include <algorithm>
+
+typedef bool boolean;
+#define NOT_A_PIN -1
+#define INPUT 0
+#define OUTPUT 1
+#define SPECIAL 0xF8
+#define FALLING 2
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+#define digitalPinToInterrupt(p) (p)
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void yield();
+void pinMode(uint8_t, uint8_t);
+void attachInterrupt(uint8_t, void (*)(), int);
+void hostInterrupt(); // runs the attached interrupt handler, as an edge on its pin
+void configTime(const char *tz, const char *server);
+
+class String
+{
+public:
+  String() {}
+  String(const char *s) : _s(s ? s : "") {}
+  String(const std::string &s) : _s(s) {}
+  String(char c) : _s(1, c) {}
+  String(int v) : _s(std::to_string(v)) {}
+  String(unsigned v) : _s(std::to_string(v)) {}
+  String(long v) : _s(std::to_string(v)) {}
+  String(unsigned long v) : _s(std::to_string(v)) {}
+  String(long long v) : _s(std::to_string(v)) {}
+  String(unsigned long long v) : _s(std::to_string(v)) {}
+  const char *c_str() const { return _s.c_str(); }
+  unsigned length() const { return _s.size(); }
+  void remove(unsigned i, unsigned n = 1) { if (i < _s.size()) _s.erase(i, n); }
+  bool concat(const String &o) { _s += o._s; return true; }
+  String &operator+=(const String &o) { _s += o._s; return *this; }
+  bool operator==(const String &o) const { return _s == o._s; }
+  bool operator==(const char *o) const { return _s == o; }
+  bool operator!=(const String &o) const { return _s != o._s; }
+  char operator[](unsigned i) const { return _s[i]; }
+  bool startsWith(const String &o) const { return _s.compare(0, o._s.size(), o._s) == 0; }
+  bool endsWith(const String &o) const { return _s.size() >= o._s.size() && _s.compare(_s.size() - o._s.size(), o._s.size(), o._s) == 0; }
+  int indexOf(char c) const { auto p = _s.find(c); return p == std::string::npos ? -1 : (int)p; }
+  int lastIndexOf(char c) const { auto p = _s.rfind(c); return p == std::string::npos ? -1 : (int)p; }
+  String substring(unsigned b) const { return b < _s.size() ? String(_s.substr(b)) : String(); }
+  String substring(unsigned b, unsigned e) const { return b < _s.size() ? String(_s.substr(b, e - b)) : String(); }
+  long toInt() const { return atol(_s.c_str()); }
+  const std::string &str() const { return _s; }
+
+private:
+  std::string _s;
+};
+inline String operator+(const String &a, const String &b) { return String(a.str() + b.str()); }
+inline String operator+(const char *a, const String &b) { return String(std::string(a) + b.str()); }
+inline String operator+(const String &a, const char *b) { return String(a.str() + b); }
+
+class Print
+{
+public:
+  virtual ~Print() {}
+  virtual size_t write(const uint8_t *buf, size_t n) = 0;
+  size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t print(const String &s) { return write((const uint8_t *)s.c_str(), s.length()); }
+  size_t print(const char *s) { return write(s); }
+  size_t print(char c) { return write((const uint8_t *)&c, 1); }
+  size_t print(int v) { return print(String(v)); }
+  size_t print(unsigned v) { return print(String(v)); }
+  size_t print(long v) { return print(String(v)); }
+  size_t print(unsigned long v) { return print(String(v)); }
+  size_t println() { return write("\r\n"); }
+  template <typename T>
+  size_t println(const T &v) { size_t n = print(v); return n + println(); }
+  size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+};
+
+class Stream : public Print
+{
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+};
+
+extern bool hostQuiet; // drop Serial output, for the fuzzer and benchmark
+
+class HardwareSerial : public Stream
+{
+public:
+  void begin(unsigned long) {}
+  size_t write(const uint8_t *buf, size_t n) override { return hostQuiet ? n : fwrite(buf, 1, n, stderr); }
+  int available() override { return 0; }
+  int read() override { return -1; }
+  using Print::write;
+};
+extern HardwareSerial Serial;
+
+#endif
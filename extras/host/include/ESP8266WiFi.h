@@ -0,0 +1,6 @@
+// Host backend: sockets stand for the WiFi stack
+#ifndef HOST_ESP8266WIFI_H
+#define HOST_ESP8266WIFI_H
+#include "Arduino.h"
+#include "WiFiClient.h"
+#endif
@@ -0,0 +1,131 @@
+// Host backend: fs::FS of the ESP8266 core on a local directory
+//
+//  each file system is rooted at the directory named by an environment
+//  variable, the current directory if it is not set
+#ifndef HOST_FS_H
+#define HOST_FS_H
+#include "Arduino.h"
+#include <memory>
+
+namespace fs
+{
+enum SeekMode
+{
+  SeekSet = 0,
+  SeekCur = 1,
+  SeekEnd = 2
+};
+
+struct FSInfo
+{
+  size_t totalBytes;
+  size_t usedBytes;
+  size_t blockSize;
+  size_t pageSize;
+  size_t maxOpenFiles;
+  size_t maxPathLength;
+};
+
+struct FSInfo64
+{
+  uint64_t totalBytes;
+  uint64_t usedBytes;
+  size_t blockSize;
+  size_t pageSize;
+  size_t maxOpenFiles;
+  size_t maxPathLength;
+};
+
+struct FileImpl;
+struct DirImpl;
+
+class File : public Stream
+{
+public:
+  File() {}
+  File(std::shared_ptr<FileImpl> p) : _p(p) {}
+  operator bool() const;
+  size_t write(const uint8_t *buf, size_t n) override;
+  using Print::write;
+  int available() override;
+  int read() override;
+  size_t read(uint8_t *buf, size_t n);
+  size_t readBytes(char *buf, size_t n) { return read((uint8_t *)buf, n); }
+  bool seek(uint32_t pos, SeekMode mode = SeekSet);
+  size_t position() const;
+  size_t size() const;
+  bool truncate(uint32_t size);
+  void flush() {}
+  void close();
+  const char *name() const;
+  const char *fullName() const;
+  bool isDirectory() const;
+  bool isFile() const;
+  time_t getLastWrite();
+  time_t getCreationTime();
+  void setTimeCallback(time_t (*cb)(void));
+  File openNextFile();
+
+private:
+  std::shared_ptr<FileImpl> _p;
+};
+
+class Dir
+{
+public:
+  Dir() {}
+  Dir(std::shared_ptr<DirImpl> p) : _p(p) {}
+  bool next();
+  String fileName();
+  size_t fileSize();
+  time_t fileTime();
+  time_t fileCreationTime();
+  bool isDirectory();
+  bool isFile();
+  File openFile(const char *mode);
+  bool rewind();
+
+private:
+  std::shared_ptr<DirImpl> _p;
+};
+
+class FS
+{
+public:
+  FS(const char *envName) : _env(envName) {}
+  bool begin();
+  void end();
+  bool info(FSInfo &info);
+  bool info64(FSInfo64 &info);
+  File open(const char *path, const char *mode = "r");
+  File open(const String &path, const char *mode) { return open(path.c_str(), mode); }
+  bool exists(const char *path);
+  bool exists(const String &path) { return exists(path.c_str()); }
+  Dir openDir(const char *path);
+  Dir openDir(const String &path) { return openDir(path.c_str()); }
+  bool remove(const char *path);
+  bool remove(const String &path) { return remove(path.c_str()); }
+  bool rename(const char *from, const char *to);
+  bool rename(const String &from, const String &to) { return rename(from.c_str(), to.c_str()); }
+  bool mkdir(const char *path);
+  bool mkdir(const String &path) { return mkdir(path.c_str()); }
+  bool rmdir(const char *path);
+  bool rmdir(const String &path) { return rmdir(path.c_str()); }
+  std::string hostPath(const char *path);
+
+private:
+  const char *_env;
+  std::string _root;
+};
+} // namespace fs
+
+using fs::Dir;
+using fs::File;
+using fs::FS;
+using fs::FSInfo;
+using fs::FSInfo64;
+using fs::SeekCur;
+using fs::SeekEnd;
+using fs::SeekMode;
+using fs::SeekSet;
+#endif
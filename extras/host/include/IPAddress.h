@@ -0,0 +1,18 @@
+// Host backend: IPv4 address in network order, as in the Arduino core
+#ifndef HOST_IPADDRESS_H
+#define HOST_IPADDRESS_H
+#include "Arduino.h"
+class IPAddress
+{
+public:
+  IPAddress() { memset(_b, 0, 4); }
+  IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) { _b[0] = a; _b[1] = b; _b[2] = c; _b[3] = d; }
+  explicit IPAddress(uint32_t v) { memcpy(_b, &v, 4); }
+  uint8_t operator[](int i) const { return _b[i]; }
+  uint8_t &operator[](int i) { return _b[i]; }
+  operator uint32_t() const { uint32_t v; memcpy(&v, _b, 4); return v; }
+  String toString() const { char s[16]; snprintf(s, sizeof(s), "%u.%u.%u.%u", _b[0], _b[1], _b[2], _b[3]); return String(s); }
+private:
+  uint8_t _b[4];
+};
+#endif
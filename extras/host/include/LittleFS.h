@@ -0,0 +1,6 @@
+// Host backend: LittleFS is the directory given by FTP_LITTLEFS_ROOT
+#ifndef HOST_LITTLEFS_H
+#define HOST_LITTLEFS_H
+#include "FS.h"
+extern fs::FS LittleFS;
+#endif
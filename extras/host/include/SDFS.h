@@ -0,0 +1,6 @@
+// Host backend: SDFS is the directory given by FTP_SDFS_ROOT
+#ifndef HOST_SDFS_H
+#define HOST_SDFS_H
+#include "FS.h"
+extern fs::FS SDFS;
+#endif
@@ -0,0 +1,6 @@
+// Host backend: sockets stand for the WiFi stack
+#ifndef HOST_WIFI_H
+#define HOST_WIFI_H
+#include "Arduino.h"
+#include "WiFiClient.h"
+#endif
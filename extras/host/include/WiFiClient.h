@@ -0,0 +1,58 @@
+// Host backend: WiFiClient and WiFiServer on non-blocking POSIX sockets
+#ifndef HOST_WIFICLIENT_H
+#define HOST_WIFICLIENT_H
+#include "Arduino.h"
+#include "IPAddress.h"
+#include <memory>
+
+class WiFiClient : public Stream
+{
+public:
+  WiFiClient() {}
+  explicit WiFiClient(int fd);
+  uint8_t connected();
+  operator bool();
+  int available() override;
+  int read() override;
+  int read(uint8_t *buf, size_t n);
+  size_t readBytes(char *buf, size_t n)
+  {
+    int r = read((uint8_t *)buf, n);
+    return r < 0 ? 0 : r;
+  }
+  size_t write(const uint8_t *buf, size_t n) override;
+  using Print::write;
+  int availableForWrite();
+  void stop();
+  void flush() {}
+  void setNoDelay(bool nodelay);
+  bool getNoDelay();
+  IPAddress localIP();
+  IPAddress remoteIP();
+  uint16_t localPort();
+  uint16_t remotePort();
+  bool connect(IPAddress ip, uint16_t port);
+
+private:
+  std::shared_ptr<int> _fd;
+};
+
+class WiFiServer
+{
+public:
+  WiFiServer(uint16_t port) : _port(port) {}
+  void begin();
+  void begin(uint16_t port) { _port = port; begin(); }
+  bool hasClient();
+  WiFiClient accept();
+  WiFiClient available() { return accept(); }
+  void stop();
+  void close() { stop(); }
+  uint16_t port() const { return _port; }
+
+private:
+  uint16_t _port;
+  int _fd = -1;
+  int _pending = -1;
+};
+#endif
@@ -0,0 +1,2 @@
+// Host backend: WiFiServer is declared with WiFiClient
+#include "WiFiClient.h"
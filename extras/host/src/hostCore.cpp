@@ -0,0 +1,47 @@
+// Host backend: time, serial console and printf of the Arduino core
+#include "Arduino.h"
+#include <stdarg.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+HardwareSerial Serial;
+bool hostQuiet = false;
+
+static struct timeval startTime = [] { struct timeval t; gettimeofday(&t, nullptr); return t; }();
+
+unsigned long millis()
+{
+  struct timeval t;
+  gettimeofday(&t, nullptr);
+  return (t.tv_sec - startTime.tv_sec) * 1000UL + (t.tv_usec - startTime.tv_usec) / 1000L;
+}
+unsigned long micros()
+{
+  struct timeval t;
+  gettimeofday(&t, nullptr);
+  return (t.tv_sec - startTime.tv_sec) * 1000000UL + (t.tv_usec - startTime.tv_usec);
+}
+void delay(unsigned long ms) { usleep(ms * 1000); }
+void yield() {}
+void pinMode(uint8_t, uint8_t) {}
+// Only the SD bus watch of sdControl attaches one
+static void (*isr)() = nullptr;
+void attachInterrupt(uint8_t, void (*handler)(), int) { isr = handler; }
+void hostInterrupt()
+{
+  if (isr != nullptr)
+    isr();
+}
+void configTime(const char *, const char *) {}
+
+size_t Print::printf(const char *fmt, ...)
+{
+  char b[512];
+  va_list ap;
+  va_start(ap, fmt);
+  int n = vsnprintf(b, sizeof(b), fmt, ap);
+  va_end(ap);
+  if (n < 0)
+    return 0;
+  return write((const uint8_t *)b, std::min<size_t>(n, sizeof(b) - 1));
+}
@@ -0,0 +1,261 @@
+// Host backend: fs::FS, File and Dir on a local directory
+#include "FS.h"
+#include "LittleFS.h"
+#include "SDFS.h"
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <fcntl.h>
+
+fs::FS LittleFS("FTP_LITTLEFS_ROOT");
+fs::FS SDFS("FTP_SDFS_ROOT");
+
+namespace fs
+{
+struct FileImpl
+{
+  FILE *f = nullptr;
+  std::string host, name, full;
+  bool dir = false;
+  bool writable = false;
+  bool dirty = false;      // written or truncated since opened
+  bool stampClean = false; // LittleFS stamps a file opened for writing even if unchanged
+  time_t (*timeCallback)(void) = nullptr;
+  DIR *d = nullptr;
+  ~FileImpl()
+  {
+    if (f)
+      fclose(f);
+    // Like the ESP8266 core, stamp a file opened for writing when closed.
+    //   SdFat only updates the directory entry of a file written to
+    if (f && writable && timeCallback && (dirty || stampClean))
+    {
+      struct timespec times[2] = {{timeCallback(), 0}, {timeCallback(), 0}};
+      utimensat(AT_FDCWD, host.c_str(), times, 0);
+    }
+    if (d)
+      closedir(d);
+  }
+};
+struct DirImpl
+{
+  DIR *d = nullptr;
+  std::string host, base;
+  std::string cur;
+  struct stat st;
+  ~DirImpl()
+  {
+    if (d)
+      closedir(d);
+  }
+};
+
+File::operator bool() const { return _p && (_p->f || _p->dir); }
+size_t File::write(const uint8_t *buf, size_t n)
+{
+  if (!_p || !_p->f)
+    return 0;
+  _p->dirty |= n > 0;
+  return fwrite(buf, 1, n, _p->f);
+}
+int File::available() { return _p && _p->f ? (int)(size() - position()) : 0; }
+int File::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+size_t File::read(uint8_t *buf, size_t n) { return _p && _p->f ? fread(buf, 1, n, _p->f) : 0; }
+bool File::seek(uint32_t pos, SeekMode mode) { return _p && _p->f && fseek(_p->f, pos, mode == SeekSet ? SEEK_SET : mode == SeekCur ? SEEK_CUR : SEEK_END) == 0; }
+size_t File::position() const { return _p && _p->f ? ftell(_p->f) : 0; }
+size_t File::size() const
+{
+  if (!_p || !_p->f)
+    return 0;
+  fflush(_p->f);
+  struct stat st;
+  return fstat(fileno(_p->f), &st) == 0 ? st.st_size : 0;
+}
+bool File::truncate(uint32_t size)
+{
+  if (!_p || !_p->f)
+    return false;
+  _p->dirty = true;
+  return fflush(_p->f) == 0 && ftruncate(fileno(_p->f), size) == 0;
+}
+void File::close() { _p.reset(); }
+const char *File::name() const { return _p ? _p->name.c_str() : ""; }
+const char *File::fullName() const { return _p ? _p->full.c_str() : ""; }
+bool File::isDirectory() const { return _p && _p->dir; }
+bool File::isFile() const { return _p && _p->f; }
+time_t File::getLastWrite()
+{
+  struct stat st;
+  return _p && stat(_p->host.c_str(), &st) == 0 ? st.st_mtime : 0;
+}
+time_t File::getCreationTime() { return getLastWrite(); }
+void File::setTimeCallback(time_t (*cb)(void))
+{
+  if (_p)
+    _p->timeCallback = cb;
+}
+File File::openNextFile()
+{
+  if (!_p || !_p->dir)
+    return File();
+  if (!_p->d)
+    _p->d = opendir(_p->host.c_str());
+  if (!_p->d)
+    return File();
+  struct dirent *e;
+  while ((e = readdir(_p->d)))
+  {
+    if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+      continue;
+    auto n = std::make_shared<FileImpl>();
+    n->host = _p->host + "/" + e->d_name;
+    n->name = e->d_name;
+    n->full = (_p->full == "/" ? "" : _p->full) + "/" + e->d_name;
+    struct stat st;
+    stat(n->host.c_str(), &st);
+    if (S_ISDIR(st.st_mode))
+      n->dir = true;
+    else
+      n->f = fopen(n->host.c_str(), "rb");
+    return File(n);
+  }
+  return File();
+}
+
+bool Dir::next()
+{
+  if (!_p || !_p->d)
+    return false;
+  struct dirent *e;
+  while ((e = readdir(_p->d)))
+  {
+    if (!strcmp(e->d_name, ".") || !strcmp(e->d_name, ".."))
+      continue;
+    _p->cur = e->d_name;
+    stat((_p->host + "/" + _p->cur).c_str(), &_p->st);
+    return true;
+  }
+  return false;
+}
+String Dir::fileName() { return _p ? String(_p->cur.c_str()) : String(); }
+size_t Dir::fileSize() { return _p && !S_ISDIR(_p->st.st_mode) ? _p->st.st_size : 0; }
+time_t Dir::fileTime() { return _p ? _p->st.st_mtime : 0; }
+time_t Dir::fileCreationTime() { return _p ? _p->st.st_ctime : 0; }
+bool Dir::isDirectory() { return _p && S_ISDIR(_p->st.st_mode); }
+bool Dir::isFile() { return _p && S_ISREG(_p->st.st_mode); }
+File Dir::openFile(const char *mode)
+{
+  auto n = std::make_shared<FileImpl>();
+  n->host = _p->host + "/" + _p->cur;
+  n->name = _p->cur;
+  n->f = fopen(n->host.c_str(), mode[0] == 'r' ? "rb" : mode[0] == 'a' ? "ab" : "wb");
+  return File(n);
+}
+bool Dir::rewind()
+{
+  if (!_p || !_p->d)
+    return false;
+  rewinddir(_p->d);
+  return true;
+}
+
+bool FS::begin()
+{
+  const char *r = getenv(_env);
+  _root = r ? r : ".";
+  return true;
+}
+void FS::end() {}
+std::string FS::hostPath(const char *path)
+{
+  if (_root.empty())
+    begin();
+  std::string p = path ? path : "/";
+  if (p.empty() || p[0] != '/')
+    p = "/" + p;
+  return _root + p;
+}
+bool FS::info(FSInfo &info)
+{
+  struct statvfs v;
+  if (statvfs(hostPath("/").c_str(), &v) < 0)
+    return false;
+  info.blockSize = v.f_bsize;
+  info.pageSize = 256;
+  info.totalBytes = (size_t)v.f_blocks * v.f_frsize;
+  info.usedBytes = info.totalBytes - (size_t)v.f_bavail * v.f_frsize;
+  info.maxOpenFiles = 16;
+  info.maxPathLength = 256;
+  return true;
+}
+bool FS::info64(FSInfo64 &info)
+{
+  struct statvfs v;
+  if (statvfs(hostPath("/").c_str(), &v) < 0)
+    return false;
+  info.blockSize = v.f_bsize;
+  info.pageSize = 256;
+  info.totalBytes = (uint64_t)v.f_blocks * v.f_frsize;
+  info.usedBytes = info.totalBytes - (uint64_t)v.f_bavail * v.f_frsize;
+  // Simulate a small volume
+  if (getenv("FTP_HOST_FREE_BYTES"))
+    info.usedBytes = info.totalBytes - strtoull(getenv("FTP_HOST_FREE_BYTES"), 0, 10);
+  info.maxOpenFiles = 16;
+  info.maxPathLength = 256;
+  return true;
+}
+File FS::open(const char *path, const char *mode)
+{
+  auto n = std::make_shared<FileImpl>();
+  n->host = hostPath(path);
+  n->full = path;
+  const char *s = strrchr(path, '/');
+  n->name = s ? s + 1 : path;
+  struct stat st;
+  if (stat(n->host.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+  {
+    n->dir = true;
+    return File(n);
+  }
+  std::string m = mode;
+  if (m == "r")
+    m = "rb";
+  else if (m == "w")
+    m = "wb";
+  else if (m == "a")
+    m = "ab";
+  else if (m == "r+")
+    m = "r+b";
+  else if (m == "w+")
+    m = "w+b";
+  else if (m == "a+")
+    m = "a+b";
+  n->f = fopen(n->host.c_str(), m.c_str());
+  if (!n->f)
+    return File();
+  n->writable = m != "rb";
+  n->stampClean = this == &LittleFS;
+  return File(n);
+}
+bool FS::exists(const char *path)
+{
+  struct stat st;
+  return stat(hostPath(path).c_str(), &st) == 0;
+}
+Dir FS::openDir(const char *path)
+{
+  auto d = std::make_shared<DirImpl>();
+  d->host = hostPath(path);
+  d->d = opendir(d->host.c_str());
+  return Dir(d);
+}
+bool FS::remove(const char *path) { return ::unlink(hostPath(path).c_str()) == 0; }
+bool FS::rename(const char *a, const char *b) { return ::rename(hostPath(a).c_str(), hostPath(b).c_str()) == 0; }
+bool FS::mkdir(const char *path) { return ::mkdir(hostPath(path).c_str(), 0755) == 0; }
+bool FS::rmdir(const char *path) { return ::rmdir(hostPath(path).c_str()) == 0; }
+} // namespace fs
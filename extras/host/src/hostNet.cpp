@@ -0,0 +1,212 @@
+// Host backend: WiFiClient and WiFiServer on non-blocking POSIX sockets
+//
+//  availableForWrite() reports the free part of half the socket send
+//  buffer, like the TCP window of lwIP on the ESP8266, or of
+//  FTP_HOST_SND_BUF bytes when it is set
+#include "WiFiClient.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+struct FdCloser
+{
+  void operator()(int *p)
+  {
+    if (*p >= 0)
+      ::close(*p);
+    delete p;
+  }
+};
+
+WiFiClient::WiFiClient(int fd) : _fd(new int(fd), FdCloser()) {}
+
+uint8_t WiFiClient::connected()
+{
+  if (!_fd || *_fd < 0)
+    return 0;
+  char c;
+  int r = recv(*_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (r > 0)
+    return 1;
+  if (r == 0)
+    return 0;
+  return (errno == EAGAIN || errno == EWOULDBLOCK) ? 1 : 0;
+}
+WiFiClient::operator bool() { return _fd && *_fd >= 0; }
+int WiFiClient::available()
+{
+  if (!_fd || *_fd < 0)
+    return 0;
+  int n = 0;
+  ioctl(*_fd, FIONREAD, &n);
+  return n;
+}
+int WiFiClient::read()
+{
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+int WiFiClient::read(uint8_t *buf, size_t n)
+{
+  if (!_fd || *_fd < 0)
+    return -1;
+  int r = recv(*_fd, buf, n, MSG_DONTWAIT);
+  return r < 0 ? -1 : r;
+}
+size_t WiFiClient::write(const uint8_t *buf, size_t n)
+{
+  if (!_fd || *_fd < 0)
+    return 0;
+  size_t done = 0;
+  while (done < n)
+  {
+    int r = send(*_fd, buf + done, n - done, MSG_NOSIGNAL);
+    if (r < 0)
+    {
+      if (errno == EAGAIN || errno == EWOULDBLOCK)
+      {
+        usleep(100);
+        continue;
+      }
+      break;
+    }
+    done += r;
+  }
+  return done;
+}
+int WiFiClient::availableForWrite()
+{
+  if (!_fd || *_fd < 0)
+    return 0;
+  int sndbuf = 0, queued = 0;
+  socklen_t l = sizeof(sndbuf);
+  getsockopt(*_fd, SOL_SOCKET, SO_SNDBUF, &sndbuf, &l);
+  ioctl(*_fd, TIOCOUTQ, &queued);
+  static const char *sndBuf = getenv("FTP_HOST_SND_BUF");
+  int n = (sndBuf != nullptr ? atoi(sndBuf) : sndbuf / 2) - queued;
+  return n > 0 ? n : 0;
+}
+void WiFiClient::stop()
+{
+  if (_fd && *_fd >= 0)
+  {
+    ::shutdown(*_fd, SHUT_RDWR);
+    ::close(*_fd);
+    *_fd = -1;
+  }
+  _fd.reset();
+}
+void WiFiClient::setNoDelay(bool nodelay)
+{
+  if (_fd && *_fd >= 0)
+  {
+    int v = nodelay;
+    setsockopt(*_fd, IPPROTO_TCP, TCP_NODELAY, &v, sizeof(v));
+  }
+}
+bool WiFiClient::getNoDelay()
+{
+  int v = 0;
+  socklen_t l = sizeof(v);
+  if (_fd && *_fd >= 0)
+    getsockopt(*_fd, IPPROTO_TCP, TCP_NODELAY, &v, &l);
+  return v;
+}
+static IPAddress sockIp(int fd, bool local, uint16_t *port = nullptr)
+{
+  sockaddr_in a{};
+  socklen_t l = sizeof(a);
+  if (fd < 0 || (local ? getsockname(fd, (sockaddr *)&a, &l) : getpeername(fd, (sockaddr *)&a, &l)) < 0)
+    return IPAddress();
+  if (port)
+    *port = ntohs(a.sin_port);
+  return IPAddress((uint32_t)a.sin_addr.s_addr);
+}
+IPAddress WiFiClient::localIP() { return sockIp(_fd ? *_fd : -1, true); }
+IPAddress WiFiClient::remoteIP() { return sockIp(_fd ? *_fd : -1, false); }
+uint16_t WiFiClient::localPort()
+{
+  uint16_t p = 0;
+  sockIp(_fd ? *_fd : -1, true, &p);
+  return p;
+}
+uint16_t WiFiClient::remotePort()
+{
+  uint16_t p = 0;
+  sockIp(_fd ? *_fd : -1, false, &p);
+  return p;
+}
+bool WiFiClient::connect(IPAddress ip, uint16_t port)
+{
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in a{};
+  a.sin_family = AF_INET;
+  a.sin_port = htons(port);
+  a.sin_addr.s_addr = (uint32_t)ip;
+  if (::connect(fd, (sockaddr *)&a, sizeof(a)) < 0)
+  {
+    ::close(fd);
+    return false;
+  }
+  fcntl(fd, F_SETFL, O_NONBLOCK);
+  _fd.reset(new int(fd), FdCloser());
+  return true;
+}
+
+void WiFiServer::begin()
+{
+  _fd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in a{};
+  a.sin_family = AF_INET;
+  a.sin_port = htons(_port);
+  a.sin_addr.s_addr = htonl(INADDR_ANY);
+  if (bind(_fd, (sockaddr *)&a, sizeof(a)) < 0 || listen(_fd, 8) < 0)
+  {
+    perror("WiFiServer::begin");
+    ::close(_fd);
+    _fd = -1;
+    return;
+  }
+  fcntl(_fd, F_SETFL, O_NONBLOCK);
+}
+bool WiFiServer::hasClient()
+{
+  if (_pending >= 0)
+    return true;
+  if (_fd < 0)
+    return false;
+  _pending = ::accept(_fd, nullptr, nullptr);
+  if (_pending >= 0)
+  {
+    fcntl(_pending, F_SETFL, O_NONBLOCK);
+    // Like lwIP, keep urgent data in the stream: ftplib's abort() sends
+    //   its last byte, the end of the ABOR line, with MSG_OOB
+    int one = 1;
+    setsockopt(_pending, SOL_SOCKET, SO_OOBINLINE, &one, sizeof(one));
+  }
+  return _pending >= 0;
+}
+WiFiClient WiFiServer::accept()
+{
+  if (!hasClient())
+    return WiFiClient();
+  int fd = _pending;
+  _pending = -1;
+  return WiFiClient(fd);
+}
+void WiFiServer::stop()
+{
+  if (_pending >= 0)
+    ::close(_pending);
+  if (_fd >= 0)
+    ::close(_fd);
+  _pending = _fd = -1;
+}
@@ -0,0 +1,48 @@
+// Host backend: runs the FTP server as a Linux process
+//
+//  users are the ones of the example sketch, "sdfs" on FTP_SDFS_ROOT and
+//  "littlefs" on FTP_LITTLEFS_ROOT, both with password "password"
+#include "ESP8266FtpServer.h"
+#include <signal.h>
+#include <unistd.h>
+
+static FtpServer ftpServer;
+static volatile sig_atomic_t running = 1;
+static volatile sig_atomic_t busActivity = 0;
+
+static void stop(int)
+{
+  running = 0;
+}
+
+static void otherMaster(int)
+{
+  busActivity = 1;
+}
+
+int main()
+{
+  // A client closing the data connection must not kill the server
+  signal(SIGPIPE, SIG_IGN);
+  // Return from main() on Ctrl-C, so valgrind and sanitizers report
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+  // kill -USR1 simulates the other master using the SD bus
+  signal(SIGUSR1, otherMaster);
+
+  ftpServer.addUser("sdfs", "password", 5);
+  ftpServer.addUser("littlefs", "password", NOT_A_PIN);
+  ftpServer.begin();
+  while (running)
+  {
+    if (busActivity)
+    {
+      busActivity = 0;
+      hostInterrupt();
+    }
+    ftpServer.handleFTP();
+    // Like loop() on the device, without taking a whole core
+    usleep(200);
+  }
+  return 0;
+}
@@ -0,0 +1,725 @@
+#include "ftpDeflate.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define DEFLATE_WSIZE (1u << FTP_DEFLATE_WINDOW_BITS)
+#define DEFLATE_HASH_BITS (FTP_DEFLATE_WINDOW_BITS - 1)
+#define DEFLATE_HASH_SIZE (1u << DEFLATE_HASH_BITS)
+#define INFLATE_WSIZE (1u << FTP_INFLATE_WINDOW_BITS)
+#define INFLATE_WMASK (INFLATE_WSIZE - 1)
+#define MIN_MATCH 3
+#define MAX_MATCH 258
+
+static const uint16_t lengthBase[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const uint8_t lengthExtra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const uint16_t distanceBase[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const uint8_t distanceExtra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const uint8_t codeLengthOrder[19] = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+static uint32_t adler32(uint32_t adler, const uint8_t *buf, size_t len)
+{
+  uint32_t a = adler & 0xFFFF;
+  uint32_t b = adler >> 16;
+  while (len > 0)
+  {
+    // 5552 bytes can be summed before b overflows
+    size_t n = len < 5552 ? len : 5552;
+    len -= n;
+    while (n-- > 0)
+    {
+      a += *buf++;
+      b += a;
+    }
+    a %= 65521;
+    b %= 65521;
+  }
+  return (b << 16) | a;
+}
+
+///////////////////////////////////////
+//                                   //
+//            COMPRESSOR             //
+//                                   //
+///////////////////////////////////////
+
+bool FtpDeflate::begin()
+{
+  end();
+  // Window holds two halves: history and input to compress
+  _mem = (uint8_t *)malloc(2 * DEFLATE_WSIZE + DEFLATE_HASH_SIZE * sizeof(uint16_t) + DEFLATE_WSIZE * sizeof(uint16_t));
+  if (_mem == nullptr)
+  {
+    return false;
+  }
+  _win = _mem;
+  _head = (uint16_t *)(_mem + 2 * DEFLATE_WSIZE);
+  _prev = _head + DEFLATE_HASH_SIZE;
+  memset(_head, 0, DEFLATE_HASH_SIZE * sizeof(uint16_t));
+  _pos = 0;
+  _end = 0;
+  _adler = 1;
+  _bitBuf = 0;
+  _bitCnt = 0;
+  _state = DEFLATE_HEADER;
+  return true;
+}
+
+void FtpDeflate::end()
+{
+  free(_mem);
+  _mem = nullptr;
+}
+
+// Free space in window for input
+//
+//  the window slides down when history before the compressed data is
+//  longer than needed
+
+uint8_t *FtpDeflate::inputBuffer(size_t *room)
+{
+  if (_pos >= DEFLATE_WSIZE)
+  {
+    memmove(_win, _win + DEFLATE_WSIZE, _end - DEFLATE_WSIZE);
+    _pos -= DEFLATE_WSIZE;
+    _end -= DEFLATE_WSIZE;
+    for (uint16_t i = 0; i < DEFLATE_HASH_SIZE; i++)
+    {
+      _head[i] = _head[i] > DEFLATE_WSIZE ? _head[i] - DEFLATE_WSIZE : 0;
+    }
+    for (uint16_t i = 0; i < DEFLATE_WSIZE; i++)
+    {
+      _prev[i] = _prev[i] > DEFLATE_WSIZE ? _prev[i] - DEFLATE_WSIZE : 0;
+    }
+  }
+  *room = 2 * DEFLATE_WSIZE - _end;
+  return _win + _end;
+}
+
+void FtpDeflate::commitInput(size_t len)
+{
+  _adler = adler32(_adler, _win + _end, len);
+  _end += len;
+}
+
+void FtpDeflate::putBits(uint32_t value, uint8_t count)
+{
+  _bitBuf |= value << _bitCnt;
+  _bitCnt += count;
+  while (_bitCnt >= 8)
+  {
+    _out[_outLen++] = _bitBuf;
+    _bitBuf >>= 8;
+    _bitCnt -= 8;
+  }
+}
+
+// Huffman codes are sent from their most significant bit
+void FtpDeflate::putCode(uint16_t code, uint8_t length)
+{
+  uint16_t reversed = 0;
+  for (uint8_t i = 0; i < length; i++)
+  {
+    reversed = (reversed << 1) | (code & 1);
+    code >>= 1;
+  }
+  putBits(reversed, length);
+}
+
+void FtpDeflate::putLiteral(uint8_t c)
+{
+  if (c < 144)
+    putCode(0x30 + c, 8);
+  else
+    putCode(0x190 + c - 144, 9);
+}
+
+void FtpDeflate::putMatch(uint16_t length, uint16_t distance)
+{
+  uint8_t code = 28;
+  while (lengthBase[code] > length)
+  {
+    code--;
+  }
+  uint16_t symbol = 257 + code;
+  if (symbol < 280)
+    putCode(symbol - 256, 7);
+  else
+    putCode(0xC0 + symbol - 280, 8);
+  putBits(length - lengthBase[code], lengthExtra[code]);
+
+  code = 29;
+  while (distanceBase[code] > distance)
+  {
+    code--;
+  }
+  putCode(code, 5);
+  putBits(distance - distanceBase[code], distanceExtra[code]);
+}
+
+void FtpDeflate::insertHash(uint16_t pos)
+{
+  uint16_t h = ((_win[pos] << 10) ^ (_win[pos + 1] << 5) ^ _win[pos + 2]) & (DEFLATE_HASH_SIZE - 1);
+  _prev[pos & (DEFLATE_WSIZE - 1)] = _head[h];
+  _head[h] = pos + 1;
+}
+
+// Find longest earlier string matching the one at _pos
+//
+// return:
+//    length of match, less than MIN_MATCH if none
+
+uint16_t FtpDeflate::longestMatch(uint16_t *distance)
+{
+  uint16_t avail = _end - _pos;
+  if (avail < MIN_MATCH)
+  {
+    return 0;
+  }
+  uint16_t maxLen = avail < MAX_MATCH ? avail : MAX_MATCH;
+  uint16_t h = ((_win[_pos] << 10) ^ (_win[_pos + 1] << 5) ^ _win[_pos + 2]) & (DEFLATE_HASH_SIZE - 1);
+  uint16_t next = _head[h];
+  uint16_t bestLen = 0;
+  uint8_t chain = FTP_DEFLATE_CHAIN;
+
+  while (next != 0 && chain-- > 0)
+  {
+    uint16_t cand = next - 1;
+    if (cand >= _pos || (uint16_t)(_pos - cand) >= DEFLATE_WSIZE)
+    {
+      break;
+    }
+    if (_win[cand + bestLen] == _win[_pos + bestLen])
+    {
+      uint16_t len = 0;
+      while (len < maxLen && _win[cand + len] == _win[_pos + len])
+      {
+        len++;
+      }
+      if (len > bestLen)
+      {
+        bestLen = len;
+        *distance = _pos - cand;
+        if (len == maxLen)
+        {
+          break;
+        }
+      }
+    }
+    uint16_t prev = _prev[cand & (DEFLATE_WSIZE - 1)];
+    if (prev >= next)
+    {
+      break; // chain entry overwritten by a newer position
+    }
+    next = prev;
+  }
+  return bestLen;
+}
+
+// Compress input of window in out
+//
+//  without finish, the last MAX_MATCH bytes of input are kept for
+//  matches with next input
+//
+// return:
+//    bytes written in out
+
+size_t FtpDeflate::deflate(uint8_t *out, size_t size, bool finish)
+{
+  _out = out;
+  _outLen = 0;
+
+  if (_state == DEFLATE_HEADER && size >= 2)
+  {
+    uint8_t cmf = ((FTP_DEFLATE_WINDOW_BITS - 8) << 4) | 8;
+    _out[_outLen++] = cmf;
+    _out[_outLen++] = (31 - (cmf * 256) % 31) % 31;
+    putBits(1, 1); // last block
+    putBits(1, 2); // fixed Huffman codes
+    _state = DEFLATE_DATA;
+  }
+
+  // A symbol takes at most 31 bits, with 7 bits pending
+  while (_state == DEFLATE_DATA && size - _outLen >= 5)
+  {
+    uint16_t avail = _end - _pos;
+    if (avail == 0 || (!finish && avail < MAX_MATCH))
+    {
+      if (!finish)
+      {
+        break;
+      }
+      putCode(0, 7); // end of block
+      if (_bitCnt > 0)
+      {
+        putBits(0, 8 - _bitCnt);
+      }
+      _state = DEFLATE_TRAILER;
+      break;
+    }
+
+    uint16_t distance = 0;
+    uint16_t len = longestMatch(&distance);
+    if (len >= MIN_MATCH)
+    {
+      putMatch(len, distance);
+      while (len-- > 0)
+      {
+        if (_end - _pos >= MIN_MATCH)
+        {
+          insertHash(_pos);
+        }
+        _pos++;
+      }
+    }
+    else
+    {
+      putLiteral(_win[_pos]);
+      if (avail >= MIN_MATCH)
+      {
+        insertHash(_pos);
+      }
+      _pos++;
+    }
+  }
+
+  if (_state == DEFLATE_TRAILER && size - _outLen >= 4)
+  {
+    _out[_outLen++] = _adler >> 24;
+    _out[_outLen++] = _adler >> 16;
+    _out[_outLen++] = _adler >> 8;
+    _out[_outLen++] = _adler;
+    _state = DEFLATE_DONE;
+  }
+  return _outLen;
+}
+
+///////////////////////////////////////
+//                                   //
+//           DECOMPRESSOR            //
+//                                   //
+///////////////////////////////////////
+
+bool FtpInflate::begin()
+{
+  end();
+  _mem = (uint8_t *)malloc(INFLATE_WSIZE + sizeof(Tables_t));
+  if (_mem == nullptr)
+  {
+    return false;
+  }
+  _win = _mem;
+  _tables = (Tables_t *)(_mem + INFLATE_WSIZE);
+  _lengthCode.symbol = _tables->lengthSymbol;
+  _distanceCode.symbol = _tables->distanceSymbol;
+  _bitBuf = 0;
+  _bitCnt = 0;
+  _state = INFLATE_STATE_HEADER;
+  _windowBits = 0;
+  _last = false;
+  _wpos = 0;
+  _unread = 0;
+  _total = 0;
+  _adler = 1;
+  return true;
+}
+
+void FtpInflate::end()
+{
+  free(_mem);
+  _mem = nullptr;
+}
+
+// Contiguous part of decompressed data not read yet
+size_t FtpInflate::output(const uint8_t **out)
+{
+  uint16_t start = (_wpos - _unread) & INFLATE_WMASK;
+  *out = _win + start;
+  return _unread < INFLATE_WSIZE - start ? _unread : INFLATE_WSIZE - start;
+}
+
+void FtpInflate::consume(size_t len)
+{
+  const uint8_t *out;
+  while (len > 0)
+  {
+    size_t n = output(&out);
+    if (n > len)
+    {
+      n = len;
+    }
+    _adler = adler32(_adler, out, n);
+    _unread -= n;
+    len -= n;
+  }
+}
+
+void FtpInflate::putByte(uint8_t c)
+{
+  _win[_wpos] = c;
+  _wpos = (_wpos + 1) & INFLATE_WMASK;
+  _unread++;
+  _total++;
+}
+
+uint32_t FtpInflate::getBits(uint8_t count)
+{
+  uint32_t value = _bitBuf & ((1ull << count) - 1);
+  _bitBuf >>= count;
+  _bitCnt -= count;
+  return value;
+}
+
+// Decode a Huffman code starting offset bits ahead, without removing it
+//
+// return:
+//    symbol, -1 if more bits are needed, -2 if code is invalid
+
+int16_t FtpInflate::decode(const Huffman_t &h, uint8_t offset, uint8_t *length)
+{
+  int16_t code = 0;
+  int16_t first = 0;
+  int16_t index = 0;
+  for (uint8_t len = 1; len < 16; len++)
+  {
+    if (offset + len > _bitCnt)
+    {
+      return -1;
+    }
+    code |= (_bitBuf >> (offset + len - 1)) & 1;
+    int16_t count = h.count[len];
+    if (code - count < first)
+    {
+      *length = len;
+      return h.symbol[index + (code - first)];
+    }
+    index += count;
+    first += count;
+    first <<= 1;
+    code <<= 1;
+  }
+  return -2;
+}
+
+// Build canonical Huffman code from code lengths
+//
+// return:
+//    negative if code is over-subscribed
+
+int16_t FtpInflate::construct(Huffman_t &h, const uint8_t *length, uint16_t n)
+{
+  int16_t offs[16];
+  memset(h.count, 0, sizeof(h.count));
+  for (uint16_t symbol = 0; symbol < n; symbol++)
+  {
+    h.count[length[symbol]]++;
+  }
+  if (h.count[0] == n)
+  {
+    return 0;
+  }
+  int16_t left = 1;
+  for (uint8_t len = 1; len < 16; len++)
+  {
+    left <<= 1;
+    left -= h.count[len];
+    if (left < 0)
+    {
+      return left;
+    }
+  }
+  offs[1] = 0;
+  for (uint8_t len = 1; len < 15; len++)
+  {
+    offs[len + 1] = offs[len] + h.count[len];
+  }
+  for (uint16_t symbol = 0; symbol < n; symbol++)
+  {
+    if (length[symbol] != 0)
+    {
+      h.symbol[offs[length[symbol]]++] = symbol;
+    }
+  }
+  return left;
+}
+
+void FtpInflate::fixedTables()
+{
+  uint8_t *lengths = _tables->lengths;
+  uint16_t symbol = 0;
+  for (; symbol < 144; symbol++)
+    lengths[symbol] = 8;
+  for (; symbol < 256; symbol++)
+    lengths[symbol] = 9;
+  for (; symbol < 280; symbol++)
+    lengths[symbol] = 7;
+  for (; symbol < 288; symbol++)
+    lengths[symbol] = 8;
+  construct(_lengthCode, lengths, 288);
+  for (symbol = 0; symbol < 30; symbol++)
+    lengths[symbol] = 5;
+  construct(_distanceCode, lengths, 30);
+}
+
+// Decode next element of the stream from bits in _bitBuf
+int8_t FtpInflate::step()
+{
+  switch (_state)
+  {
+  case INFLATE_STATE_HEADER:
+  {
+    if (_bitCnt < 16)
+      return STEP_NEED_INPUT;
+    uint8_t cmf = getBits(8);
+    uint8_t flg = getBits(8);
+    if ((cmf & 0x0F) != 8 || (cmf >> 4) > 7 || (cmf * 256 + flg) % 31 != 0 || (flg & 0x20))
+      return STEP_ERROR;
+    // Matches may reach back to the window the compressor used, refuse
+    //   the stream now rather than at the first match out of ours
+    _windowBits = (cmf >> 4) + 8;
+    if (_windowBits > FTP_INFLATE_WINDOW_BITS)
+      return STEP_ERROR;
+    _state = INFLATE_STATE_BLOCK;
+    return STEP_OK;
+  }
+
+  case INFLATE_STATE_BLOCK:
+  {
+    if (_bitCnt < 3)
+      return STEP_NEED_INPUT;
+    _last = getBits(1);
+    uint8_t type = getBits(2);
+    if (type == 0)
+    {
+      getBits(_bitCnt % 8); // stored block starts on a byte
+      _state = INFLATE_STATE_STORED;
+    }
+    else if (type == 1)
+    {
+      fixedTables();
+      _state = INFLATE_STATE_CODES;
+    }
+    else if (type == 2)
+      _state = INFLATE_STATE_TABLE;
+    else
+      return STEP_ERROR;
+    return STEP_OK;
+  }
+
+  case INFLATE_STATE_STORED:
+  {
+    if (_bitCnt < 32)
+      return STEP_NEED_INPUT;
+    uint16_t len = getBits(16);
+    uint16_t nlen = getBits(16);
+    if (len != (uint16_t)~nlen)
+      return STEP_ERROR;
+    _copyLen = len;
+    _state = INFLATE_STATE_STORED_COPY;
+    return STEP_OK;
+  }
+
+  case INFLATE_STATE_STORED_COPY:
+    while (_copyLen > 0)
+    {
+      if (_unread == INFLATE_WSIZE)
+        return STEP_OUTPUT_FULL;
+      if (_bitCnt < 8)
+        return STEP_NEED_INPUT;
+      putByte(getBits(8));
+      _copyLen--;
+    }
+    _state = _last ? INFLATE_STATE_TRAILER : INFLATE_STATE_BLOCK;
+    return STEP_OK;
+
+  case INFLATE_STATE_TABLE:
+    if (_bitCnt < 14)
+      return STEP_NEED_INPUT;
+    _nlen = getBits(5) + 257;
+    _ndist = getBits(5) + 1;
+    _ncode = getBits(4) + 4;
+    if (_nlen > 286 || _ndist > 30)
+      return STEP_ERROR;
+    _index = 0;
+    memset(_tables->lengths, 0, 19);
+    _state = INFLATE_STATE_CODE_LENGTHS;
+    return STEP_OK;
+
+  case INFLATE_STATE_CODE_LENGTHS:
+    while (_index < _ncode)
+    {
+      if (_bitCnt < 3)
+        return STEP_NEED_INPUT;
+      _tables->lengths[codeLengthOrder[_index++]] = getBits(3);
+    }
+    if (construct(_lengthCode, _tables->lengths, 19) != 0)
+      return STEP_ERROR; // code lengths code must be complete
+    _index = 0;
+    _state = INFLATE_STATE_LENGTHS;
+    return STEP_OK;
+
+  case INFLATE_STATE_LENGTHS:
+    while (_index < _nlen + _ndist)
+    {
+      uint8_t codeLen;
+      int16_t symbol = decode(_lengthCode, 0, &codeLen);
+      if (symbol == -1)
+        return STEP_NEED_INPUT;
+      if (symbol < 0)
+        return STEP_ERROR;
+      if (symbol < 16)
+      {
+        getBits(codeLen);
+        _tables->lengths[_index++] = symbol;
+        continue;
+      }
+      uint8_t extra = symbol == 16 ? 2 : (symbol == 17 ? 3 : 7);
+      if (_bitCnt < codeLen + extra)
+        return STEP_NEED_INPUT;
+      getBits(codeLen);
+      uint8_t len = 0;
+      uint8_t repeat;
+      if (symbol == 16)
+      {
+        if (_index == 0)
+          return STEP_ERROR;
+        len = _tables->lengths[_index - 1];
+        repeat = 3 + getBits(2);
+      }
+      else if (symbol == 17)
+        repeat = 3 + getBits(3);
+      else
+        repeat = 11 + getBits(7);
+      if (_index + repeat > _nlen + _ndist)
+        return STEP_ERROR;
+      while (repeat-- > 0)
+        _tables->lengths[_index++] = len;
+    }
+    if (_tables->lengths[256] == 0)
+      return STEP_ERROR; // no end of block code
+    if (construct(_lengthCode, _tables->lengths, _nlen) < 0 ||
+        construct(_distanceCode, _tables->lengths + _nlen, _ndist) < 0)
+      return STEP_ERROR;
+    _state = INFLATE_STATE_CODES;
+    return STEP_OK;
+
+  case INFLATE_STATE_CODES:
+  {
+    uint8_t codeLen;
+    int16_t symbol = decode(_lengthCode, 0, &codeLen);
+    if (symbol == -1)
+      return STEP_NEED_INPUT;
+    if (symbol < 0 || symbol > 285)
+      return STEP_ERROR;
+    if (symbol < 256)
+    {
+      if (_unread == INFLATE_WSIZE)
+        return STEP_OUTPUT_FULL;
+      getBits(codeLen);
+      putByte(symbol);
+      return STEP_OK;
+    }
+    if (symbol == 256)
+    {
+      getBits(codeLen);
+      _state = _last ? INFLATE_STATE_TRAILER : INFLATE_STATE_BLOCK;
+      return STEP_OK;
+    }
+    // Length and distance are taken together, in at most 48 bits
+    symbol -= 257;
+    uint8_t lenExtra = lengthExtra[symbol];
+    if (_bitCnt < codeLen + lenExtra)
+      return STEP_NEED_INPUT;
+    uint8_t distLen;
+    int16_t distSymbol = decode(_distanceCode, codeLen + lenExtra, &distLen);
+    if (distSymbol == -1)
+      return STEP_NEED_INPUT;
+    if (distSymbol < 0 || distSymbol > 29)
+      return STEP_ERROR;
+    uint8_t distExtra = distanceExtra[distSymbol];
+    if (_bitCnt < codeLen + lenExtra + distLen + distExtra)
+      return STEP_NEED_INPUT;
+    getBits(codeLen);
+    _copyLen = lengthBase[symbol] + getBits(lenExtra);
+    getBits(distLen);
+    uint32_t distance = distanceBase[distSymbol] + getBits(distExtra);
+    if (distance > _total || distance > INFLATE_WSIZE)
+      return STEP_ERROR; // beyond start of data, or of our window
+    _copyDist = distance;
+    _state = INFLATE_STATE_COPY;
+    return STEP_OK;
+  }
+
+  case INFLATE_STATE_COPY:
+    while (_copyLen > 0)
+    {
+      if (_unread == INFLATE_WSIZE)
+        return STEP_OUTPUT_FULL;
+      putByte(_win[(_wpos - _copyDist) & INFLATE_WMASK]);
+      _copyLen--;
+    }
+    _state = INFLATE_STATE_CODES;
+    return STEP_OK;
+
+  case INFLATE_STATE_TRAILER:
+  {
+    // Checksum is verified once all output is read
+    if (_unread > 0)
+      return STEP_OUTPUT_FULL;
+    getBits(_bitCnt % 8);
+    if (_bitCnt < 32)
+      return STEP_NEED_INPUT;
+    uint32_t adler = getBits(8) << 24;
+    adler |= getBits(8) << 16;
+    adler |= getBits(8) << 8;
+    adler |= getBits(8);
+    if (adler != _adler)
+      return STEP_ERROR;
+    _state = INFLATE_STATE_DONE;
+    return STEP_DONE;
+  }
+
+  case INFLATE_STATE_DONE:
+    return STEP_DONE;
+
+  case INFLATE_STATE_ERROR:
+    break;
+  }
+  return STEP_ERROR;
+}
+
+// Decompress in, until all of it is used or output window is full
+//
+// return:
+//    INFLATE_MORE, INFLATE_DONE or INFLATE_ERROR
+
+int8_t FtpInflate::inflate(const uint8_t *in, size_t len, size_t *used)
+{
+  size_t pos = 0;
+  int8_t rc;
+  do
+  {
+    while (_bitCnt <= 56 && pos < len)
+    {
+      _bitBuf |= (uint64_t)in[pos++] << _bitCnt;
+      _bitCnt += 8;
+    }
+    rc = step();
+  } while (rc == STEP_OK);
+  *used = pos;
+
+  if (rc == STEP_ERROR)
+  {
+    _state = INFLATE_STATE_ERROR;
+    return INFLATE_ERROR;
+  }
+  return rc == STEP_DONE ? INFLATE_DONE : INFLATE_MORE;
+}
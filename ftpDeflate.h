@@ -0,0 +1,145 @@
+#ifndef FTP_DEFLATE_H
+#define FTP_DEFLATE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FTP_DEFLATE_WINDOW_BITS 10 // MODE Z compressor window is 2^bits bytes, it uses 5 times that (9..14)
+#define FTP_DEFLATE_CHAIN 32       // max earlier positions compared for each match
+#define FTP_INFLATE_WINDOW_BITS 13 // MODE Z decompressor window is 2^bits bytes, farther matches fail (8..15)
+
+typedef enum
+{
+  INFLATE_ERROR = -1,
+  INFLATE_MORE = 0, // give more input, or read output
+  INFLATE_DONE = 1
+} InflateStatus_t;
+
+// zlib stream compressor for MODE Z downloads
+//
+//  input is copied in the window with inputBuffer()/commitInput(), then
+//  deflate() compresses it using fixed Huffman codes
+class FtpDeflate
+{
+public:
+  FtpDeflate() {}
+  bool begin();
+  void end();
+  uint8_t *inputBuffer(size_t *room);
+  void commitInput(size_t len);
+  size_t deflate(uint8_t *out, size_t size, bool finish);
+  bool finished() { return _state == DEFLATE_DONE; }
+
+private:
+  typedef enum
+  {
+    DEFLATE_HEADER,
+    DEFLATE_DATA,
+    DEFLATE_TRAILER,
+    DEFLATE_DONE
+  } DeflateState_t;
+
+  void putBits(uint32_t value, uint8_t count);
+  void putCode(uint16_t code, uint8_t length);
+  void putLiteral(uint8_t c);
+  void putMatch(uint16_t length, uint16_t distance);
+  void insertHash(uint16_t pos);
+  uint16_t longestMatch(uint16_t *distance);
+
+  uint8_t *_mem = nullptr; // window, hash heads and chains in one allocation
+  uint8_t *_win;
+  uint16_t *_head;
+  uint16_t *_prev;
+  uint16_t _pos; // next byte of window to compress
+  uint16_t _end; // end of input in window
+  uint32_t _adler;
+  uint32_t _bitBuf;
+  uint8_t _bitCnt;
+  uint8_t _state;
+  uint8_t *_out;
+  size_t _outLen;
+};
+
+// zlib stream decompressor for MODE Z uploads
+//
+//  output is kept in the window for matches, read it with output()
+//  and consume() before giving more input
+class FtpInflate
+{
+public:
+  FtpInflate() {}
+  bool begin();
+  void end();
+  int8_t inflate(const uint8_t *in, size_t len, size_t *used);
+  size_t output(const uint8_t **out);
+  void consume(size_t len);
+  bool finished() { return _state == INFLATE_STATE_DONE; }
+  uint8_t windowBits() { return _windowBits; } // window of the stream, from its header
+
+private:
+  typedef enum
+  {
+    INFLATE_STATE_HEADER,
+    INFLATE_STATE_BLOCK,
+    INFLATE_STATE_STORED,
+    INFLATE_STATE_STORED_COPY,
+    INFLATE_STATE_TABLE,
+    INFLATE_STATE_CODE_LENGTHS,
+    INFLATE_STATE_LENGTHS,
+    INFLATE_STATE_CODES,
+    INFLATE_STATE_COPY,
+    INFLATE_STATE_TRAILER,
+    INFLATE_STATE_DONE,
+    INFLATE_STATE_ERROR
+  } InflateState_t;
+
+  typedef enum
+  {
+    STEP_OK,
+    STEP_NEED_INPUT,
+    STEP_OUTPUT_FULL,
+    STEP_DONE,
+    STEP_ERROR
+  } StepStatus_t;
+
+  typedef struct
+  {
+    int16_t count[16];
+    int16_t *symbol;
+  } Huffman_t;
+
+  typedef struct
+  {
+    int16_t lengthSymbol[288];
+    int16_t distanceSymbol[30];
+    uint8_t lengths[320];
+  } Tables_t;
+
+  int8_t step();
+  uint32_t getBits(uint8_t count);
+  int16_t decode(const Huffman_t &h, uint8_t offset, uint8_t *length);
+  static int16_t construct(Huffman_t &h, const uint8_t *length, uint16_t n);
+  void fixedTables();
+  void putByte(uint8_t c);
+
+  uint8_t *_mem = nullptr; // window and tables in one allocation
+  uint8_t *_win;
+  Tables_t *_tables;
+  Huffman_t _lengthCode;
+  Huffman_t _distanceCode;
+  uint64_t _bitBuf;
+  uint8_t _bitCnt;
+  uint8_t _state;
+  uint8_t _windowBits; // 0 until the header is read
+  bool _last;         // current block is the last one
+  uint16_t _wpos;     // next byte to write in window
+  uint16_t _unread;   // bytes of window not read by output()
+  uint32_t _total;    // bytes decompressed
+  uint16_t _index;    // next code length to read
+  uint16_t _nlen, _ndist, _ncode;
+  uint16_t _copyLen;  // length of stored block or match left to copy
+  uint16_t _copyDist; // distance of match
+  uint32_t _adler;
+};
+
+#endif
@@ -0,0 +1,276 @@
+#include "ftpDirCache.h"
+
+#if FTP_DIR_CACHE_ENTRIES > 0
+
+// Length of directory path without trailing '/', except for root
+
+size_t FtpDirCache::dirLength(const char *dir)
+{
+  size_t len = strlen(dir);
+  while (len > 1 && dir[len - 1] == '/')
+  {
+    len--;
+  }
+  return len;
+}
+
+boolean FtpDirCache::isDir(const CachedDir_t &cached, FS *fs, const char *dir, size_t len)
+{
+  return cached.fs == fs && strlen(cached.dir) == len && strncmp(cached.dir, dir, len) == 0;
+}
+
+// Start reading the cached listing of dir, must be matched by readEnd()
+//
+// return:
+//    slot of the directory, -1 if it isn't cached
+
+int8_t FtpDirCache::readBegin(FS *fs, const char *dir)
+{
+  size_t len = dirLength(dir);
+  for (int8_t i = 0; i < FTP_DIR_CACHE_DIRS; i++)
+  {
+    CachedDir_t &cached = _dirs[i];
+    if (cached.state == CACHE_VALID && isDir(cached, fs, dir, len))
+    {
+      cached.readers++;
+      cached.used = ++_uses;
+      return i;
+    }
+  }
+  return -1;
+}
+
+void FtpDirCache::readEnd(int8_t slot)
+{
+  if (slot < 0 || _dirs[slot].readers == 0)
+  {
+    return;
+  }
+  CachedDir_t &cached = _dirs[slot];
+  if (--cached.readers == 0 && cached.state == CACHE_STALE)
+  {
+    cached.state = CACHE_EMPTY;
+  }
+}
+
+uint16_t FtpDirCache::count(int8_t slot)
+{
+  return _dirs[slot].count;
+}
+
+const DirCacheEntry_t &FtpDirCache::entry(int8_t slot, uint16_t i)
+{
+  return _dirs[slot].entry[i];
+}
+
+const char *FtpDirCache::name(int8_t slot, uint16_t i)
+{
+  return _dirs[slot].names + _dirs[slot].entry[i].name;
+}
+
+// Look for a file in cache
+//
+// return:
+//    true if the directory of path is cached and holds the file
+
+boolean FtpDirCache::find(FS *fs, const char *path, DirCacheEntry_t *entry)
+{
+  const char *slash = strrchr(path, '/');
+  if (slash == NULL)
+  {
+    return false;
+  }
+  for (int8_t i = 0; i < FTP_DIR_CACHE_DIRS; i++)
+  {
+    CachedDir_t &cached = _dirs[i];
+    if (cached.state != CACHE_VALID || !isDir(cached, fs, path, slash == path ? 1 : slash - path))
+    {
+      continue;
+    }
+    for (uint16_t j = 0; j < cached.count; j++)
+    {
+      if (strcmp(cached.names + cached.entry[j].name, slash + 1) == 0)
+      {
+        *entry = cached.entry[j];
+        return true;
+      }
+    }
+    return false;
+  }
+  return false;
+}
+
+// Start caching the listing of dir, entries are given by fillAdd()
+//
+//  an empty slot is taken first, else the least recently used one that
+//  no listing reads
+//
+// return:
+//    false if no slot is free, or dir is filled by another listing
+
+boolean FtpDirCache::fillBegin(FS *fs, const char *dir, const void *owner)
+{
+  size_t len = dirLength(dir);
+  if (len >= FTP_DIR_CACHE_PATH)
+  {
+    return false;
+  }
+  CachedDir_t *slot = nullptr;
+  for (int8_t i = 0; i < FTP_DIR_CACHE_DIRS; i++)
+  {
+    CachedDir_t &cached = _dirs[i];
+    if (cached.state == CACHE_FILLING && isDir(cached, fs, dir, len))
+    {
+      return false;
+    }
+    if (cached.state == CACHE_EMPTY)
+    {
+      if (slot == nullptr || slot->state != CACHE_EMPTY)
+      {
+        slot = &cached;
+      }
+    }
+    else if (cached.state == CACHE_VALID && cached.readers == 0 &&
+             (slot == nullptr || (slot->state != CACHE_EMPTY && cached.used < slot->used)))
+    {
+      slot = &cached;
+    }
+  }
+  if (slot == nullptr)
+  {
+    return false;
+  }
+  slot->state = CACHE_FILLING;
+  slot->owner = owner;
+  slot->fs = fs;
+  strncpy(slot->dir, dir, len);
+  slot->dir[len] = 0;
+  slot->count = 0;
+  slot->namesLen = 0;
+  return true;
+}
+
+FtpDirCache::CachedDir_t *FtpDirCache::filling(const void *owner)
+{
+  for (int8_t i = 0; i < FTP_DIR_CACHE_DIRS; i++)
+  {
+    if (_dirs[i].state == CACHE_FILLING && _dirs[i].owner == owner)
+    {
+      return &_dirs[i];
+    }
+  }
+  return nullptr;
+}
+
+void FtpDirCache::fillAdd(const void *owner, const char *name, uint32_t size, time_t time, boolean isDir)
+{
+  CachedDir_t *cached = filling(owner);
+  if (cached == nullptr)
+  {
+    return;
+  }
+  size_t len = strlen(name) + 1;
+  if (cached->count >= FTP_DIR_CACHE_ENTRIES || cached->namesLen + len > FTP_DIR_CACHE_NAMES)
+  {
+    // Directory too large to be cached
+    drop(*cached);
+    return;
+  }
+  DirCacheEntry_t &entry = cached->entry[cached->count++];
+  entry.size = size;
+  entry.time = time;
+  entry.isDir = isDir;
+  entry.name = cached->namesLen;
+  memcpy(cached->names + cached->namesLen, name, len);
+  cached->namesLen += len;
+}
+
+void FtpDirCache::fillEnd(const void *owner)
+{
+  CachedDir_t *cached = filling(owner);
+  if (cached != nullptr)
+  {
+    cached->state = CACHE_VALID;
+    cached->owner = nullptr;
+    cached->used = ++_uses;
+  }
+}
+
+void FtpDirCache::fillAbort(const void *owner)
+{
+  CachedDir_t *cached = filling(owner);
+  if (cached != nullptr)
+  {
+    drop(*cached);
+  }
+}
+
+// Entries being read stay until their last reader is done
+void FtpDirCache::drop(CachedDir_t &cached)
+{
+  cached.state = cached.readers > 0 ? CACHE_STALE : CACHE_EMPTY;
+  cached.owner = nullptr;
+}
+
+// Drop the cache, files were changed out of the server
+void FtpDirCache::clear()
+{
+  for (int8_t i = 0; i < FTP_DIR_CACHE_DIRS; i++)
+  {
+    if (_dirs[i].state != CACHE_EMPTY)
+    {
+      drop(_dirs[i]);
+    }
+  }
+}
+
+// Drop the cached directories that are path, the directory holding it,
+//   or one of its parents
+
+void FtpDirCache::invalidate(FS *fs, const char *path)
+{
+  size_t len = dirLength(path);
+  const char *slash = strrchr(path, '/');
+  size_t parent = (slash == NULL || slash == path) ? 1 : slash - path;
+  if (parent > len)
+  {
+    parent = len;
+  }
+  for (int8_t i = 0; i < FTP_DIR_CACHE_DIRS; i++)
+  {
+    CachedDir_t &cached = _dirs[i];
+    if (cached.state == CACHE_EMPTY || cached.state == CACHE_STALE || cached.fs != fs)
+    {
+      continue;
+    }
+    // Cached directory is in parent of path
+    if (strncmp(cached.dir, path, parent) == 0 &&
+        (cached.dir[parent] == 0 || cached.dir[parent] == '/' || parent == 1))
+    {
+      drop(cached);
+    }
+  }
+}
+
+#else
+
+// Cache disabled: nothing is kept, listings and SIZE go to the file system
+
+int8_t FtpDirCache::readBegin(FS *, const char *) { return -1; }
+void FtpDirCache::readEnd(int8_t) {}
+uint16_t FtpDirCache::count(int8_t) { return 0; }
+const DirCacheEntry_t &FtpDirCache::entry(int8_t, uint16_t)
+{
+  static const DirCacheEntry_t none = {};
+  return none;
+}
+const char *FtpDirCache::name(int8_t, uint16_t) { return ""; }
+boolean FtpDirCache::find(FS *, const char *, DirCacheEntry_t *) { return false; }
+boolean FtpDirCache::fillBegin(FS *, const char *, const void *) { return false; }
+void FtpDirCache::fillAdd(const void *, const char *, uint32_t, time_t, boolean) {}
+void FtpDirCache::fillEnd(const void *) {}
+void FtpDirCache::fillAbort(const void *) {}
+void FtpDirCache::invalidate(FS *, const char *) {}
+void FtpDirCache::clear() {}
+
+#endif
@@ -0,0 +1,85 @@
+#ifndef FTP_DIR_CACHE_H
+#define FTP_DIR_CACHE_H
+
+#include <FS.h>
+
+// The cache only sees changes made through the server: enable it when
+//   the sketch calls FtpServer::invalidateDirCache() after its own writes
+#ifndef FTP_DIR_CACHE_ENTRIES
+#define FTP_DIR_CACHE_ENTRIES 0   // max entries of a cached directory, 0 disables the cache
+#endif
+#ifndef FTP_DIR_CACHE_DIRS
+#define FTP_DIR_CACHE_DIRS 2      // directories cached, each takes room for FTP_DIR_CACHE_ENTRIES and FTP_DIR_CACHE_NAMES
+#endif
+#define FTP_DIR_CACHE_NAMES 2048  // bytes for names of a cached directory
+#define FTP_DIR_CACHE_PATH 128    // max length of cached directory path
+
+typedef struct
+{
+  uint32_t size;
+  time_t time;
+  uint16_t name; // offset of name in names
+  boolean isDir;
+} DirCacheEntry_t;
+
+// Metadata of the last listed directories, shared by all sessions, so
+//   repeated listings and SIZE don't go to the file system. Commands
+//   changing a directory must invalidate() it
+//
+//  a listing reads a cached directory between readBegin() and readEnd(),
+//  across calls of handleFTP(): meanwhile its entries are neither
+//  refilled nor dropped, invalidate() only keeps them from new readers
+class FtpDirCache
+{
+public:
+  FtpDirCache() {}
+  int8_t readBegin(FS *fs, const char *dir);
+  void readEnd(int8_t slot);
+  uint16_t count(int8_t slot);
+  const DirCacheEntry_t &entry(int8_t slot, uint16_t i);
+  const char *name(int8_t slot, uint16_t i);
+  boolean find(FS *fs, const char *path, DirCacheEntry_t *entry);
+
+  boolean fillBegin(FS *fs, const char *dir, const void *owner);
+  void fillAdd(const void *owner, const char *name, uint32_t size, time_t time, boolean isDir);
+  void fillEnd(const void *owner);
+  void fillAbort(const void *owner);
+
+  void invalidate(FS *fs, const char *path);
+  void clear();
+
+#if FTP_DIR_CACHE_ENTRIES > 0
+private:
+  typedef enum
+  {
+    CACHE_EMPTY,
+    CACHE_FILLING,
+    CACHE_VALID,
+    CACHE_STALE // dropped, freed when its last reader is done
+  } CacheState_t;
+
+  typedef struct
+  {
+    uint8_t state;
+    uint8_t readers;   // listings reading the entries
+    const void *owner; // listing filling the entries
+    FS *fs;
+    uint32_t used;     // value of _uses at last use, the least recently used is refilled first
+    char dir[FTP_DIR_CACHE_PATH];
+    DirCacheEntry_t entry[FTP_DIR_CACHE_ENTRIES];
+    char names[FTP_DIR_CACHE_NAMES];
+    uint16_t count;
+    uint16_t namesLen;
+  } CachedDir_t;
+
+  static size_t dirLength(const char *dir);
+  static boolean isDir(const CachedDir_t &cached, FS *fs, const char *dir, size_t len);
+  CachedDir_t *filling(const void *owner);
+  static void drop(CachedDir_t &cached);
+
+  CachedDir_t _dirs[FTP_DIR_CACHE_DIRS] = {};
+  uint32_t _uses = 0;
+#endif
+};
+
+#endif
@@ -0,0 +1,251 @@
+#include "ftpDirList.h"
+#include <time.h>
+
+#define FTP_LIST_LINE_SIZE 320 // room needed in buffer to format one entry
+
+// Format time as YYYYMMDDHHMMSS in UTC, as RFC 3659 wants for facts and MDTM
+void EpochToISO(time_t epochTime, char *buffer, size_t size)
+{
+  tm utcTime;
+  gmtime_r(&epochTime, &utcTime);
+  if (strftime(buffer, size, "%Y%m%d%H%M%S", &utcTime) == 0 && size > 0)
+  {
+    buffer[0] = 0;
+  }
+}
+
+// Open directory to list
+//
+// return:
+//    false if directory can't be opened
+
+boolean FtpDirList::begin(FS *fs, const char *path, ListFormat_t format, FtpDirCache *cache)
+{
+  end();
+  _format = format;
+  _cache = cache;
+  _index = 0;
+  _slot = _cache->readBegin(fs, path);
+  if (_slot >= 0)
+  {
+    return true;
+  }
+#ifdef ESP8266
+  if (!fs->exists(path))
+  {
+    return false;
+  }
+  _dir = fs->openDir(path);
+#elif defined ESP32
+  _root = fs->open(path);
+  if (!_root || !_root.isDirectory())
+  {
+    _root.close();
+    return false;
+  }
+#endif
+  _cache->fillBegin(fs, path, this);
+  return true;
+}
+
+void FtpDirList::end()
+{
+  if (_cache != nullptr)
+  {
+    _cache->fillAbort(this);
+    _cache->readEnd(_slot);
+  }
+  _slot = -1;
+#ifdef ESP8266
+  _dir = Dir();
+#elif defined ESP32
+  _entry.close();
+  _root.close();
+#endif
+  _eof = false;
+  _count = 0;
+  _bytes = 0;
+  _len = 0;
+  _pos = 0;
+}
+
+// Read next entry of directory
+//
+// return:
+//    false if there is no more entry
+
+boolean FtpDirList::nextEntry()
+{
+  if (_slot >= 0)
+  {
+    if (_index >= _cache->count(_slot))
+    {
+      return false;
+    }
+    const DirCacheEntry_t &entry = _cache->entry(_slot, _index);
+    _name = _cache->name(_slot, _index++);
+    _size = entry.size;
+    _time = entry.time;
+    _isDir = entry.isDir;
+    return true;
+  }
+
+#ifdef ESP8266
+  if (!_dir.next())
+  {
+    _cache->fillEnd(this);
+    return false;
+  }
+  _fileName = _dir.fileName();
+  _name = _fileName.c_str();
+  _isDir = _dir.isDirectory();
+  _size = _isDir ? 0 : _dir.fileSize();
+  _time = _isDir ? _dir.fileCreationTime() : _dir.fileTime();
+#elif defined ESP32
+  _entry = _root.openNextFile();
+  if (!_entry)
+  {
+    _cache->fillEnd(this);
+    return false;
+  }
+  // Older cores give the full path as name
+  _name = _entry.name();
+  const char *slash = strrchr(_name, '/');
+  if (slash != NULL)
+  {
+    _name = slash + 1;
+  }
+  _isDir = _entry.isDirectory();
+  _size = _isDir ? 0 : _entry.size();
+  _time = _entry.getLastWrite();
+#endif
+  _cache->fillAdd(this, _name, _size, _time, _isDir);
+  return true;
+}
+
+// Format current entry in line
+//
+// return:
+//    length of the formatted line
+
+size_t FtpDirList::formatEntry(char *line, size_t size)
+{
+  int len;
+
+  if (_format == MLSD_FORMAT)
+  {
+    len = formatFacts(line, size, _name, _size, _time, _isDir);
+    if (len > 0 && (size_t)len + 2 < size)
+    {
+      line[len++] = '\r';
+      line[len++] = '\n';
+      line[len] = 0;
+    }
+    else
+      len = size;
+  }
+  else if (_format == LIST_FORMAT)
+  {
+    if (_isDir)
+      len = snprintf(line, size, "+/,\t%s\r\n", _name);
+    else
+      len = snprintf(line, size, "+r,s%lu,\t%s\r\n", (unsigned long)_size, _name);
+  }
+  else
+  {
+    len = snprintf(line, size, "%s\r\n", _name);
+  }
+
+  if (len < 0 || (size_t)len >= size)
+  {
+    return 0; // entry doesn't fit, skip it
+  }
+  return len;
+}
+
+// Format RFC 3659 facts of an entry, as MLSD and MLST send them
+//
+// return:
+//    length of the formatted facts, size or more if they don't fit
+
+int FtpDirList::formatFacts(char *line, size_t size, const char *name, uint32_t fileSize, time_t time, boolean isDir)
+{
+  char modify[15];
+  EpochToISO(time, modify, sizeof(modify));
+  if (isDir)
+    return snprintf(line, size, "Type=dir;Modify=%s; %s", modify, name);
+  return snprintf(line, size, "Type=file;Size=%lu;Modify=%s; %s", (unsigned long)fileSize, modify, name);
+}
+
+// Format next entries in buf
+//
+// return:
+//    bytes formatted, 0 if all entries are formatted or buf is too small
+
+size_t FtpDirList::fill(char *buf, size_t size)
+{
+  size_t len = 0;
+  while (!_eof && size - len >= FTP_LIST_LINE_SIZE)
+  {
+    if (!nextEntry())
+    {
+      _eof = true;
+    }
+    else
+    {
+      size_t n = formatEntry(buf + len, size - len);
+      if (n > 0)
+      {
+        len += n;
+        _count++;
+      }
+    }
+  }
+  return len;
+}
+
+// Format next entries in buf and send them on data connection
+//
+//  sends as much as the send window takes, by full segments when the
+//  window holds at least one, the rest stays in buf for the next call
+//
+// return:
+//    false when all of the listing is sent
+
+boolean FtpDirList::send(WiFiClient &data, char *buf, size_t size)
+{
+  // Move what was not sent yet at beginning of buffer
+  if (_pos > 0)
+  {
+    _len -= _pos;
+    memmove(buf, buf + _pos, _len);
+    _pos = 0;
+  }
+
+  _len += fill(buf + _len, size - _len);
+
+  size_t pending = _len - _pos;
+#ifdef ESP32
+  size_t room = pending;
+#else
+  size_t room = data.availableForWrite();
+#endif
+  if (pending > room)
+  {
+    pending = room;
+  }
+  if (!_eof && room >= FTP_TCP_MSS)
+  {
+    // Only full segments until end of listing, lwIP builds with a
+    //   smaller MSS or send buffer get what fits
+    pending -= pending % FTP_TCP_MSS;
+  }
+  if (pending > 0)
+  {
+    pending = data.write((uint8_t *)buf + _pos, pending);
+    _pos += pending;
+    _bytes += pending;
+  }
+
+  return !_eof || _pos < _len;
+}
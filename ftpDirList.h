@@ -0,0 +1,62 @@
+#ifndef FTP_DIR_LIST_H
+#define FTP_DIR_LIST_H
+
+#include <FS.h>
+#include <WiFiClient.h>
+#include "ftpDirCache.h"
+
+#define FTP_TCP_MSS 1460 // TCP maximum segment size, listings are sent by multiple of it when the window allows
+
+typedef enum
+{
+  LIST_FORMAT, // EPLF, for LIST
+  MLSD_FORMAT, // RFC 3659 facts, for MLSD
+  NLST_FORMAT  // names only, for NLST
+} ListFormat_t;
+
+void EpochToISO(time_t epochTime, char *buffer, size_t size);
+
+// Directory listing sent in pieces: each call to send() formats the next
+//   entries in a buffer and sends it by full segments, so a large
+//   directory doesn't block the loop
+class FtpDirList
+{
+public:
+  FtpDirList() {}
+  boolean begin(FS *fs, const char *path, ListFormat_t format, FtpDirCache *cache);
+  size_t fill(char *buf, size_t size);
+  boolean send(WiFiClient &data, char *buf, size_t size);
+  void end();
+  boolean eof() { return _eof; }
+  uint16_t count() { return _count; }
+  uint32_t bytes() { return _bytes; }
+  ListFormat_t format() { return _format; }
+  static int formatFacts(char *line, size_t size, const char *name, uint32_t fileSize, time_t time, boolean isDir);
+
+private:
+  boolean nextEntry();
+  size_t formatEntry(char *line, size_t size);
+
+#ifdef ESP8266
+  Dir _dir;
+  String _fileName; // keeps _name valid until next entry
+#elif defined ESP32
+  File _root;
+  File _entry;
+#endif
+  FtpDirCache *_cache = nullptr;
+  int8_t _slot = -1;   // slot of cache entries are read from, -1 if read from file system
+  uint16_t _index;     // next entry in cache
+  ListFormat_t _format;
+  const char *_name;   // name of current entry
+  uint32_t _size;      // size of current entry
+  time_t _time;        // modification time of current entry
+  boolean _isDir;      // current entry is a directory
+  boolean _eof;        // all entries are formatted
+  uint16_t _count;     // number of entries listed
+  size_t _len;         // bytes formatted in buffer
+  size_t _pos;         // bytes of buffer already sent
+  uint32_t _bytes;     // bytes sent on data connection
+};
+
+#endif
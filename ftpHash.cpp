@@ -0,0 +1,330 @@
+#include "ftpHash.h"
+#include <string.h>
+#include <strings.h>
+
+static const char *hashNames[HASH_COUNT] = {"SHA-256", "SHA-1", "MD5", "CRC32"};
+
+static const uint32_t md5K[64] = {
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a,
+    0xa8304613, 0xfd469501, 0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821, 0xf61e2562, 0xc040b340,
+    0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8,
+    0x676f02d9, 0x8d2a4c8a, 0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70, 0x289b7ec6, 0xeaa127fa,
+    0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92,
+    0xffeff47d, 0x85845dd1, 0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const uint32_t sha256K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+    0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+    0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147,
+    0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b,
+    0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+    0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static const uint32_t sha256H[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+static const uint32_t crc32Nibble[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+    0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+};
+static inline uint32_t rotl(uint32_t x, uint8_t n)
+{
+  return (x << n) | (x >> (32 - n));
+}
+
+static inline uint32_t rotr(uint32_t x, uint8_t n)
+{
+  return (x >> n) | (x << (32 - n));
+}
+
+static inline uint32_t getBE(const uint8_t *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline uint32_t getLE(const uint8_t *p)
+{
+  return ((uint32_t)p[3] << 24) | ((uint32_t)p[2] << 16) | ((uint32_t)p[1] << 8) | p[0];
+}
+
+// Algorithm from its name in HASH and OPTS HASH, case insensitive
+//
+// return:
+//    algorithm, or -1 if unknown
+
+int8_t FtpHash::find(const char *name)
+{
+  for (uint8_t i = 0; i < HASH_COUNT; i++)
+  {
+    if (strcasecmp(name, hashNames[i]) == 0)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+const char *FtpHash::name(uint8_t algo)
+{
+  return hashNames[algo];
+}
+
+void FtpHash::begin(uint8_t algo)
+{
+  static const uint32_t md5H[4] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476};
+  static const uint32_t sha1H[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+
+  _algo = algo;
+  _length = 0;
+  _used = 0;
+  if (algo == HASH_SHA256)
+    memcpy(_state, sha256H, sizeof(sha256H));
+  else if (algo == HASH_SHA1)
+    memcpy(_state, sha1H, sizeof(sha1H));
+  else if (algo == HASH_MD5)
+    memcpy(_state, md5H, sizeof(md5H));
+  else
+    _state[0] = 0xffffffff;
+}
+
+void FtpHash::update(const uint8_t *data, size_t len)
+{
+  _length += len;
+  if (_algo == HASH_CRC32)
+  {
+    uint32_t crc = _state[0];
+    while (len-- > 0)
+    {
+      crc ^= *data++;
+      crc = (crc >> 4) ^ crc32Nibble[crc & 15];
+      crc = (crc >> 4) ^ crc32Nibble[crc & 15];
+    }
+    _state[0] = crc;
+    return;
+  }
+  if (_used > 0)
+  {
+    size_t nb = 64u - _used;
+    if (nb > len)
+      nb = len;
+    memcpy(_buf + _used, data, nb);
+    _used += nb;
+    data += nb;
+    len -= nb;
+    if (_used < 64)
+    {
+      return;
+    }
+    block(_buf);
+    _used = 0;
+  }
+  // Whole blocks are hashed in place
+  while (len >= 64)
+  {
+    block(data);
+    data += 64;
+    len -= 64;
+  }
+  memcpy(_buf, data, len);
+  _used = len;
+}
+
+// Pad last block with the length and write the digest as lower case hex
+//   in hex, at least FTP_HASH_HEX_SIZE bytes
+
+void FtpHash::finish(char *hex)
+{
+  static const char digits[] = "0123456789abcdef";
+  uint8_t words;
+
+  if (_algo == HASH_CRC32)
+  {
+    uint32_t crc = ~_state[0];
+    for (int8_t i = 7; i >= 0; i--, crc >>= 4)
+    {
+      hex[i] = digits[crc & 15];
+    }
+    hex[8] = 0;
+    return;
+  }
+
+  uint64_t bits = _length * 8;
+  _buf[_used++] = 0x80;
+  if (_used > 56)
+  {
+    memset(_buf + _used, 0, 64 - _used);
+    block(_buf);
+    _used = 0;
+  }
+  memset(_buf + _used, 0, 56 - _used);
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    // MD5 puts the length little endian, SHA big endian
+    _buf[_algo == HASH_MD5 ? 56 + i : 63 - i] = bits >> (8 * i);
+  }
+  block(_buf);
+
+  words = _algo == HASH_SHA256 ? 8 : _algo == HASH_SHA1 ? 5 : 4;
+  for (uint8_t w = 0; w < words; w++)
+  {
+    for (uint8_t i = 0; i < 4; i++)
+    {
+      uint8_t byte = _algo == HASH_MD5 ? _state[w] >> (8 * i) : _state[w] >> (24 - 8 * i);
+      *hex++ = digits[byte >> 4];
+      *hex++ = digits[byte & 15];
+    }
+  }
+  *hex = 0;
+}
+
+void FtpHash::block(const uint8_t *p)
+{
+  if (_algo == HASH_SHA256)
+    sha256Block(p);
+  else if (_algo == HASH_SHA1)
+    sha1Block(p);
+  else
+    md5Block(p);
+}
+
+void FtpHash::md5Block(const uint8_t *p)
+{
+  static const uint8_t shift[16] = {7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21};
+  uint32_t m[16];
+  for (uint8_t i = 0; i < 16; i++)
+  {
+    m[i] = getLE(p + 4 * i);
+  }
+  uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+  for (uint8_t i = 0; i < 64; i++)
+  {
+    uint32_t f;
+    uint8_t g;
+    if (i < 16)
+    {
+      f = (b & c) | (~b & d);
+      g = i;
+    }
+    else if (i < 32)
+    {
+      f = (d & b) | (~d & c);
+      g = (5 * i + 1) & 15;
+    }
+    else if (i < 48)
+    {
+      f = b ^ c ^ d;
+      g = (3 * i + 5) & 15;
+    }
+    else
+    {
+      f = c ^ (b | ~d);
+      g = (7 * i) & 15;
+    }
+    f += a + md5K[i] + m[g];
+    a = d;
+    d = c;
+    c = b;
+    b += rotl(f, shift[(i >> 4) * 4 + (i & 3)]);
+  }
+  _state[0] += a;
+  _state[1] += b;
+  _state[2] += c;
+  _state[3] += d;
+}
+
+void FtpHash::sha1Block(const uint8_t *p)
+{
+  // Message schedule kept as a ring of 16 words
+  uint32_t w[16];
+  for (uint8_t i = 0; i < 16; i++)
+  {
+    w[i] = getBE(p + 4 * i);
+  }
+  uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3], e = _state[4];
+  for (uint8_t i = 0; i < 80; i++)
+  {
+    if (i >= 16)
+    {
+      w[i & 15] = rotl(w[(i + 13) & 15] ^ w[(i + 8) & 15] ^ w[(i + 2) & 15] ^ w[i & 15], 1);
+    }
+    uint32_t f, k;
+    if (i < 20)
+    {
+      f = (b & c) | (~b & d);
+      k = 0x5a827999;
+    }
+    else if (i < 40)
+    {
+      f = b ^ c ^ d;
+      k = 0x6ed9eba1;
+    }
+    else if (i < 60)
+    {
+      f = (b & c) | (b & d) | (c & d);
+      k = 0x8f1bbcdc;
+    }
+    else
+    {
+      f = b ^ c ^ d;
+      k = 0xca62c1d6;
+    }
+    uint32_t t = rotl(a, 5) + f + e + k + w[i & 15];
+    e = d;
+    d = c;
+    c = rotl(b, 30);
+    b = a;
+    a = t;
+  }
+  _state[0] += a;
+  _state[1] += b;
+  _state[2] += c;
+  _state[3] += d;
+  _state[4] += e;
+}
+
+void FtpHash::sha256Block(const uint8_t *p)
+{
+  uint32_t w[16];
+  for (uint8_t i = 0; i < 16; i++)
+  {
+    w[i] = getBE(p + 4 * i);
+  }
+  uint32_t s[8];
+  memcpy(s, _state, sizeof(s));
+  for (uint8_t i = 0; i < 64; i++)
+  {
+    if (i >= 16)
+    {
+      uint32_t w15 = w[(i + 1) & 15], w2 = w[(i + 14) & 15];
+      w[i & 15] += (rotr(w15, 7) ^ rotr(w15, 18) ^ (w15 >> 3)) + w[(i + 9) & 15] +
+                   (rotr(w2, 17) ^ rotr(w2, 19) ^ (w2 >> 10));
+    }
+    uint32_t t1 = s[7] + (rotr(s[4], 6) ^ rotr(s[4], 11) ^ rotr(s[4], 25)) +
+                  ((s[4] & s[5]) ^ (~s[4] & s[6])) + sha256K[i] + w[i & 15];
+    uint32_t t2 = (rotr(s[0], 2) ^ rotr(s[0], 13) ^ rotr(s[0], 22)) +
+                  ((s[0] & s[1]) ^ (s[0] & s[2]) ^ (s[1] & s[2]));
+    memmove(s + 1, s, 7 * sizeof(uint32_t));
+    s[4] += t1;
+    s[0] = t1 + t2;
+  }
+  for (uint8_t i = 0; i < 8; i++)
+  {
+    _state[i] += s[i];
+  }
+}
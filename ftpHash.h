@@ -0,0 +1,44 @@
+#ifndef FTP_HASH_H
+#define FTP_HASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FTP_HASH_HEX_SIZE 65 // hex digest of the longest hash (SHA-256) and ending 0
+
+typedef enum
+{
+  HASH_SHA256 = 0, // default of HASH
+  HASH_SHA1 = 1,
+  HASH_MD5 = 2,
+  HASH_CRC32 = 3,
+  HASH_COUNT
+} HashAlgo_t;
+
+// Incremental digest for HASH and XCRC/XMD5/XSHA256: data is given in
+//   pieces with update(), finish() gives the digest in hex
+class FtpHash
+{
+public:
+  FtpHash() {}
+  static int8_t find(const char *name);
+  static const char *name(uint8_t algo);
+  void begin(uint8_t algo);
+  void update(const uint8_t *data, size_t len);
+  void finish(char *hex);
+  uint8_t algo() { return _algo; }
+
+private:
+  void block(const uint8_t *p);
+  void md5Block(const uint8_t *p);
+  void sha1Block(const uint8_t *p);
+  void sha256Block(const uint8_t *p);
+
+  uint8_t _algo;
+  uint64_t _length;  // bytes hashed
+  uint8_t _buf[64];  // bytes of the block not complete yet
+  uint8_t _used;     // bytes in _buf
+  uint32_t _state[8]; // digest so far, the CRC in _state[0]
+};
+
+#endif
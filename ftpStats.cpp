@@ -0,0 +1,87 @@
+#include "ftpStats.h"
+#include "ESP8266FtpServer.h"
+
+void FtpHistogram::add(uint32_t us)
+{
+  uint8_t i = 0;
+  while (i < FTP_STATS_BUCKETS - 1 && (us >> i) > 0)
+  {
+    i++;
+  }
+  _bucket[i]++;
+  _count++;
+  _sum += us;
+  if (us > _max)
+  {
+    _max = us;
+  }
+}
+
+void FtpHistogram::clear()
+{
+  memset(_bucket, 0, sizeof(_bucket));
+  _count = 0;
+  _max = 0;
+  _sum = 0;
+}
+
+// Non empty buckets as "<limit:count", limit being the upper bound in us
+//
+// return:
+//    length of text, cut to fit buf
+
+size_t FtpHistogram::format(char *buf, size_t size) const
+{
+  int len = snprintf(buf, size, "%lu samples, mean %lu us, max %lu us",
+                     (unsigned long)_count, (unsigned long)mean(), (unsigned long)_max);
+  for (uint8_t i = 0; i < FTP_STATS_BUCKETS && len >= 0 && (size_t)len < size; i++)
+  {
+    if (_bucket[i] > 0)
+    {
+      if (i < FTP_STATS_BUCKETS - 1)
+        len += snprintf(buf + len, size - len, " <%lu:%lu", 1ul << i, (unsigned long)_bucket[i]);
+      else
+        len += snprintf(buf + len, size - len, " >=%lu:%lu", 1ul << (i - 1), (unsigned long)_bucket[i]);
+    }
+  }
+  if (len < 0)
+  {
+    len = 0;
+    buf[0] = 0;
+  }
+  return (size_t)len < size ? len : size - 1;
+}
+
+void FtpStats::clear()
+{
+  commands = 0;
+  transfers = 0;
+  failedTransfers = 0;
+  bytesSent = 0;
+  bytesReceived = 0;
+  memset(&last, 0, sizeof(last));
+  handleTime.clear();
+  commandTime.clear();
+}
+
+void FtpStats::addTransfer(const FtpTransferStats_t &transfer)
+{
+  transfers++;
+  if (!transfer.completed)
+  {
+    failedTransfers++;
+  }
+  if (transfer.type == STORE_DATA)
+  {
+    bytesReceived += transfer.bytes;
+  }
+  else
+  {
+    bytesSent += transfer.bytes;
+  }
+  last = transfer;
+  if (callback != nullptr)
+  {
+    callback(transfer);
+  }
+}
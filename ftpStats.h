@@ -0,0 +1,64 @@
+#ifndef FTP_STATS_H
+#define FTP_STATS_H
+
+#include <Arduino.h>
+
+#define FTP_STATS_BUCKETS 24 // log2 buckets of histograms, the last one counts all longer durations
+#define FTP_STATS_TEXT_SIZE 256 // room to format a histogram
+
+// Distribution of durations in microseconds
+//
+//  bucket 0 counts durations below 1 us, bucket i those from 2^(i-1)
+//  to 2^i - 1 us
+class FtpHistogram
+{
+public:
+  FtpHistogram() { clear(); }
+  void add(uint32_t us);
+  void clear();
+  uint32_t count() const { return _count; }
+  uint32_t max() const { return _max; }
+  uint32_t mean() const { return _count > 0 ? _sum / _count : 0; }
+  uint32_t bucket(uint8_t i) const { return _bucket[i]; }
+  size_t format(char *buf, size_t size) const;
+
+private:
+  uint32_t _bucket[FTP_STATS_BUCKETS];
+  uint32_t _count;
+  uint32_t _max;
+  uint64_t _sum;
+};
+
+// Figures of one transfer, given to the stats callback when it ends
+typedef struct
+{
+  uint8_t type;        // RETRIVE_DATA, STORE_DATA or LIST_DATA
+  boolean completed;   // false if transfer was aborted or failed
+  uint32_t bytes;      // bytes on data connection
+  uint32_t durationMs; // from data connection to end of transfer
+  uint32_t netStalls;  // calls with data to send and no TCP room, or nothing received
+  uint32_t fsMicros;   // time spent in file system reads and writes
+} FtpTransferStats_t;
+
+typedef void (*FtpStatsCallback)(const FtpTransferStats_t &stats);
+
+// Counters of the server since begin() or last clear()
+class FtpStats
+{
+public:
+  FtpStats() { clear(); }
+  void clear();
+  void addTransfer(const FtpTransferStats_t &transfer);
+
+  uint32_t commands;          // command lines processed
+  uint32_t transfers;         // transfers ended
+  uint32_t failedTransfers;   // transfers aborted or failed
+  uint64_t bytesSent;         // RETR and listings
+  uint64_t bytesReceived;     // STOR
+  FtpTransferStats_t last;    // last transfer ended
+  FtpHistogram handleTime;    // duration of handleFTP() calls
+  FtpHistogram commandTime;   // time to process a command line
+  FtpStatsCallback callback = nullptr; // called at end of each transfer
+};
+
+#endif
@@ -0,0 +1,56 @@
+#include "ftpTuner.h"
+
+// Set block size of file system and max read size, tuning starts over
+//   if the block size changed
+
+void FtpChunkTuner::begin(uint16_t block, uint16_t max)
+{
+  if (block == _block)
+  {
+    return;
+  }
+  _block = block;
+  _blocks = max / block > 0 ? max / block : 1;
+#if FTP_RETR_AUTOTUNE
+  _trial = _blocks;
+#else
+  _trial = 0;
+#endif
+  _bytes = 0;
+  _micros = 0;
+  _bestRate = 0;
+}
+
+// return:
+//    bytes to read at once
+
+uint16_t FtpChunkTuner::size()
+{
+  return (_trial > 0 ? _trial : _blocks) * _block;
+}
+
+// Account bytes read by a transfer with a read size, in micros of
+//   file system time
+
+void FtpChunkTuner::add(uint16_t size, uint32_t bytes, uint32_t micros)
+{
+  if (_trial == 0 || size != _trial * _block)
+  {
+    return;
+  }
+  _bytes += bytes;
+  _micros += micros;
+  if (_bytes < FTP_TUNE_BYTES)
+  {
+    return;
+  }
+  uint32_t rate = (uint64_t)_bytes * 1000 / (_micros > 0 ? _micros : 1);
+  if (rate > _bestRate)
+  {
+    _bestRate = rate;
+    _blocks = _trial;
+  }
+  _trial--;
+  _bytes = 0;
+  _micros = 0;
+}
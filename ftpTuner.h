@@ -0,0 +1,31 @@
+#ifndef FTP_TUNER_H
+#define FTP_TUNER_H
+
+#include <Arduino.h>
+
+#define FTP_RETR_AUTOTUNE 0        // 1 to measure each RETR read size and keep the fastest
+#define FTP_TUNE_BYTES 65536ul     // bytes read with a size before it is rated
+
+// Read size of RETR for one file system: a multiple of its block size,
+//   so reads end on block boundaries. By default the largest that fits
+//   a RETR buffer; with FTP_RETR_AUTOTUNE each multiple is tried in turn
+//   on the next transfers and the one reading fastest is kept
+class FtpChunkTuner
+{
+public:
+  FtpChunkTuner() {}
+  void begin(uint16_t block, uint16_t max);
+  uint16_t size();
+  void add(uint16_t size, uint32_t bytes, uint32_t micros);
+  boolean tuning() { return _trial > 0; }
+
+private:
+  uint16_t _block = 0; // block size of file system
+  uint8_t _blocks;     // blocks per read once tuned
+  uint8_t _trial;      // blocks per read being measured, 0 when tuned
+  uint32_t _bytes;     // read with the trial size
+  uint32_t _micros;    //  and time spent
+  uint32_t _bestRate;  // bytes per ms of best size so far
+};
+
+#endif
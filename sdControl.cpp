@@ -5,12 +5,61 @@
 volatile uint32_t SDControl::_spiBlockoutTime = 0;
 bool SDControl::_weTookBus = false;
 uint8_t SDControl::_csPin = NOT_A_PIN;
+volatile uint32_t SDControl::_lastEdge = 0;
+SDContention_t SDControl::_contention = {0, 0, SPI_BLOCKOUT_PERIOD_MS / SPI_BLOCKOUT_MARGIN, SPI_BLOCKOUT_PERIOD_MS, 0, 0, 0, 0};
+uint32_t SDControl::_deniedSince = 0;
+uint32_t SDControl::_tookAt = 0;
+volatile uint32_t SDControl::_releasedAt = 0;
+
+// Activity of the other master on CS: the bus is left to it for the
+//   blockout period after each edge
+//
+//  the blockout is learned as a margin over the longest gap seen inside
+//  bursts of edges. An edge within SPI_BLOCKOUT_MARGIN blockouts of the
+//  previous one is in the same burst: a gap past the blockout raises the
+//  longest gap, so the blockout grows to cover pauses of the master. A
+//  later edge starts a new burst, and the longest gap fades a bit, so a
+//  master that became quicker frees the bus sooner
+//
+//  edges while the FTP server holds the bus are its own accesses on CS
+//  and are ignored. An edge within SPI_COLLISION_WINDOW_MS of the release
+//  is a collision: the master was waiting for the bus. If the server took
+//  the bus less than SPI_BLOCKOUT_PERIOD_MS after the previous edge, the
+//  learned blockout was too short and goes back to that period
 
 IRAM_ATTR void onBusActivitylInterrupt()
 {
 	if (!sdControl._weTookBus)
 	{
-		sdControl._spiBlockoutTime = millis() + SPI_BLOCKOUT_PERIOD_MS;
+		SDContention_t &c = SDControl::_contention;
+		uint32_t now = millis();
+		uint32_t gap = now - SDControl::_lastEdge;
+		if (c.edges == 0 || gap >= c.blockoutMs * SPI_BLOCKOUT_MARGIN)
+		{
+			c.bursts++;
+			c.longestGap -= c.longestGap / SPI_BLOCKOUT_FORGET;
+		}
+		else if (gap > c.longestGap)
+		{
+			c.longestGap = gap;
+		}
+		if (SDControl::_releasedAt != 0 && now - SDControl::_releasedAt < SPI_COLLISION_WINDOW_MS)
+		{
+			c.collisions++;
+			if (c.edges > 0 && SDControl::_tookAt - SDControl::_lastEdge < SPI_BLOCKOUT_PERIOD_MS)
+				c.longestGap = SPI_BLOCKOUT_PERIOD_MS / SPI_BLOCKOUT_MARGIN;
+		}
+		SDControl::_releasedAt = 0;
+		c.edges++;
+#if SPI_BLOCKOUT_ADAPTIVE
+		c.blockoutMs = c.longestGap * SPI_BLOCKOUT_MARGIN;
+		if (c.blockoutMs < SPI_BLOCKOUT_MIN_MS)
+			c.blockoutMs = SPI_BLOCKOUT_MIN_MS;
+		if (c.blockoutMs > SPI_BLOCKOUT_PERIOD_MS)
+			c.blockoutMs = SPI_BLOCKOUT_PERIOD_MS;
+#endif
+		SDControl::_lastEdge = now;
+		sdControl._spiBlockoutTime = now + c.blockoutMs;
 	}
 }
 
@@ -24,8 +73,15 @@ void SDControl::setup(uint8_t csPin)
 bool SDControl::takeBusControl()
 {
 	bool returnValue = false;
-	if (_spiBlockoutTime < millis())
+	if (blockoutLeft() == 0)
 	{
+		_contention.grants++;
+		if (_deniedSince != 0)
+		{
+			_contention.blockedMs += millis() - _deniedSince;
+			_deniedSince = 0;
+		}
+		_tookAt = millis();
 		_weTookBus = true;
 		// LED_ON;
 		pinMode(MISO_PIN, SPECIAL);
@@ -35,6 +91,11 @@ bool SDControl::takeBusControl()
 
 		returnValue = true;
 	}
+	else if (_deniedSince == 0)
+	{
+		_contention.denials++;
+		_deniedSince = millis() | 1; // 0 means no wait
+	}
 
 	return returnValue;
 }
@@ -46,7 +107,21 @@ bool SDControl::releaseBusControl()
 	pinMode(SCLK_PIN, INPUT);
 	pinMode(_csPin, INPUT);
 	// LED_OFF;
+	if (_weTookBus)
+	{
+		_releasedAt = millis() | 1; // 0 means no release to check
+	}
 	_weTookBus = false;
 
 	return true;
 }
+
+// return:
+//    ms until the other master is considered done with the bus, 0 if
+//    the bus can be taken now
+
+uint32_t SDControl::blockoutLeft()
+{
+	int32_t left = _spiBlockoutTime - millis();
+	return left > 0 ? left : 0;
+}
@@ -2,8 +2,27 @@
 #define SD_CONTROL_H
 #include <stdint.h>
 
-#define SPI_BLOCKOUT_PERIOD_SECONDS 20u
+#define SPI_BLOCKOUT_PERIOD_SECONDS 20u // longest blockout after activity of the other master
 #define SPI_BLOCKOUT_PERIOD_MS (SPI_BLOCKOUT_PERIOD_SECONDS * 1000u)
+#define SPI_BLOCKOUT_ADAPTIVE 1    // 1 to learn the blockout from gaps inside bursts of the other master
+#define SPI_BLOCKOUT_MIN_MS 500u   // shortest learned blockout
+#define SPI_BLOCKOUT_MARGIN 2u     // blockout is this times the longest gap seen inside a burst
+#define SPI_BLOCKOUT_FORGET 4u     // at each new burst, longest gap loses 1/this, so the blockout follows the master
+                                   // an edge within SPI_BLOCKOUT_MARGIN blockouts is in the same burst and raises it
+#define SPI_COLLISION_WINDOW_MS 50u // an edge this soon after the FTP server released the bus is a collision
+
+// Use of the SD bus by the other master and by the FTP server
+typedef struct
+{
+  uint32_t edges;      // falling edges of CS by the other master
+  uint32_t bursts;     // runs of edges closer than the blockout
+  uint32_t longestGap; // ms, longest gap between edges of a burst
+  uint32_t blockoutMs; // blockout applied after an edge
+  uint32_t grants;     // takeBusControl() that got the bus
+  uint32_t denials;    // waits for the bus: refused takeBusControl() until next grant
+  uint32_t blockedMs;  // time spent in these waits
+  uint32_t collisions; // edges right after the FTP server released the bus, counted in edges too
+} SDContention_t;
 
 class SDControl
 {
@@ -12,9 +31,16 @@ public:
   static void setup(uint8_t pin);
   static bool takeBusControl();
   static bool releaseBusControl();
+  static uint32_t blockoutLeft();
+  static SDContention_t contention() { return _contention; }
   static volatile uint32_t _spiBlockoutTime;
   static bool _weTookBus;
   static uint8_t _csPin;
+  static volatile uint32_t _lastEdge; // millis() of last edge of the other master
+  static SDContention_t _contention;  // updated by the interrupt and takeBusControl()
+  static uint32_t _deniedSince;       // millis() of first refusal of current wait, 0 if none
+  static uint32_t _tookAt;            // millis() of last grant
+  static volatile uint32_t _releasedAt; // millis() of release after a grant, 0 once an edge came
 
 private:
 };